@@ -20,6 +20,8 @@
 
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <map>
@@ -28,11 +30,20 @@
 #include <cstring>
 #include <random>
 #include <functional>
+#include <algorithm>
+#include <cmath>
 #include <bitset>   
 #include <utility> 
+#include <array>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <chrono>
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #include <signal.h>
 #include <unistd.h>
@@ -48,8 +59,12 @@
 #include <netinet/ip_icmp.h>
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <net/ethernet.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -57,33 +72,716 @@
 #ifdef LINUX_OS
 #include <sys/prctl.h>
 #include <sys/capability.h>
+#include <linux/if_packet.h>
+#include <net/route.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#if defined(SO_TXTIME) && defined(SCM_TXTIME)
+#define HAVE_TXTIME
+#endif
+#ifdef __has_include
+#if __has_include(<linux/if_xdp.h>)
+#define HAVE_AFXDP
+#include <linux/if_xdp.h>
+#ifndef AF_XDP
+#define AF_XDP  44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+#ifndef XDP_USE_NEED_WAKEUP
+#define XDP_USE_NEED_WAKEUP  (1 << 3)
+#endif
+#ifndef XDP_RING_NEED_WAKEUP
+#define XDP_RING_NEED_WAKEUP (1 << 0)
+#endif
+#endif
+#endif
+#endif
+
+#if defined(LINUX_OS) && defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_CHKSFMV
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define HAVE_CHKSNEON
+#include <arm_neon.h>
 #endif
 
 namespace wh{
     
     enum SHUTSTAT { SHDEACT, SHACT, SHEXPIRED };
-    enum LIMITS   { MAXPARAMS=6, MAXSNDPKTSIZE=2560, MAXRCVPKTSIZE=65535, MAXSCANPACKETS=500 };
-    enum PARAMS   { NOPAR=1, BNTPAR=5, SCANPAR=3, KILLPAR=2, SERPAR=3, PLDPAR=4, ALLPAR=2 };
-    enum JOB      { THREAD, DESCR, RUN };
+    enum LIMITS   { MAXPARAMS=20, MAXSNDPKTSIZE=2560, MAXRCVPKTSIZE=65535, MAXSCANPACKETS=500, MAXBATCH=1024,
+                    MAXWORKERS=64, SHELLBUFSIZE=4096 };
+    enum PARAMS   { NOPAR=1, BNTPAR=5, SCANPAR=3, KILLPAR=2, SERPAR=3, PLDPAR=4, ALLPAR=2,
+                    BNTPARMAX=15, SCANPARMAX=9, PCAPPARMAX=5, REPLAYPAR=3, REPLAYPARMAX=9,
+                    FUZZPARMAX=19 };
+    enum JOBSNAP  { SNAPID, SNAPDESCR, SNAPSTATS };
+    enum JOBSLOT  { SLOTFREE, SLOTBUSY, SLOTLIVE };
+    enum REGISTRY { MAXJOBS=256, CACHELINE=64 };
+    enum PROBE    { PROBEMAGIC=0x57485052, PROBEIDBASE=0xA000, PROBEGRACEMS=1000, PROBETTL=64, PROBEMAXGAPS=3600 };
+    enum HIST     { HISTSUBBITS=7, HISTMAXMSB=40, HISTBUCKETS=(HISTMAXMSB - HISTSUBBITS + 3) << (HISTSUBBITS - 1) };
+    enum STATSSHM { ERRSLOTS=64, ICMPTYPES=256, STATSPUBMS=250, STATSMAGIC=0x57485354, STATSVERSION=1 };
+    enum SCANOUT  { SCANCSV, SCANJSON };
+    enum SCANTIME { SCANGRACEMS=500, SCANFLUSHMS=200 };
+    enum LOGRING  { LOGSLOTS=1024, LOGHDRSIZE=64, LOGDATASIZE=MAXSNDPKTSIZE };
+    enum LOGKIND  { LOGTEXT, LOGDUMP };
+    enum PCAP     { PCAPSLOTS=1024, PCAPSNAPDEF=256, PCAPBUFSIZE=1 << 20, PCAPFLUSHMS=100,
+                    PCAPMAGICNS=0xa1b23c4d, PCAPLINKRAW=101 };
+    enum PCAPDIR  { PCAPSENT=1, PCAPRECV=2, PCAPBOTH=3 };
+    enum PCAPFIX  { PCAPASIS, PCAPLINK, PCAPRAW };
+    enum REPLAY   { REPLAYBATCH=64, REPLAYHDRMAX=80, PCAPHDRLEN=24, PCAPRECLEN=16 };
     enum JOBTYPE  { STD, SCAN};
     enum CODE     { CODEMIN,  CODEMAX, CODEPSIZE };
     enum IPHDRDEF { DEFHDRLEN=5, DEFTOS=0x0, DEFFRAGOFF=0x0, DEFCHKSUM=0x0, DEFTRASPICMP=1, DEFID=0xF0F0 };
     enum STAGES   { BATCH, WAIT, INTERACTIVE };
     enum PAYLOAD  { NOPLD, STDPLD, MAXPLD, INVLENPLD, INVCHKSPLD, BITSPLD };
     enum CMDTYPE  { SRVCMD, ENVCMD, PLOADCMD };
-    enum SCANMODE { ALL, ALLTYPE, ALLCODE, VALIDS};
+    enum SCANMODE { ALL, ALLTYPE, ALLCODE, VALIDS, ADAPTIVE};
+    enum ADAPT    { ADAPTBURST=32, ADAPTPROBEPPS=50, ADAPTLATFACTOR=3 };
+    enum BACKEND  { RAWSOCK, PKTMMAP, AFXDP };
+    enum TXRING   { TXFRAMEMIN=2048, TXBLOCKSIZE=65536, TXBLOCKNR=64 };
+    enum XSKRING  { XSKCHUNKSIZE=4096, XSKRINGSIZE=2048, XSKMAXFRAMES=8 };
+    enum RATEUNIT { PPS, BPS };
+    enum TXTIME   { TXHORIZONMS=100 };
+    enum RXLIMITS { RXBATCH=32, RXPOOLSIZE=64, RXPOLLMS=200, RXANYTYPE=-1 };
+    enum RXSUB    { SUBDST, SUBTYPE, SUBPRINT, SUBSTATS };
+    enum RXITEM   { ITEMID, ITEMBUF, ITEMLEN };
+    enum TIMERITEM{ TMTOKEN, TMACTION };
+    enum RXFILTER { FLTMAXPEERS=64, FLTMAXTYPES=16 };
+    enum AFFINITY { AFFNONE, AFFLIST, AFFAUTO, AFFNUMA };
+    enum RNDPOOL  { RNDLANES=4, RNDPOOLSIZE=1 << 18, RNDHDRLEN=28 };
+    enum FUZZSTRAT{ FZFLIP, FZBOUND, FZRANDOM, FZMIXED };
+    enum FUZZFIELD{ FZVHL, FZTOS, FZLEN, FZID, FZOFF, FZTTL, FZPROTO, FZSUM, 
+                    FZTYPE, FZCODE, FZICSUM, FZREST, FZPAYLOAD, FZFIELDS };
+    enum FUZZ     { FUZZMAXEDITS=4, FUZZIPSUM=10, FUZZICMPSUM=22 };
+    enum FUZZEDIT { EDITOFF, EDITWIDTH, EDITOLD };
+    enum PROFILE  { PRHOLD, PRRAMP, PRSTEP, PRSAW };
+    enum PHASEFLD { PHSTART, PHEND, PHSHAPE, PHFROM, PHTO, PHARG };
+    enum SCENARIO { SCNETHOVERHEAD=38, SCNMAXPHASES=4096 };
     
     static volatile sig_atomic_t               shutDown = SHDEACT;
+
+    #ifndef LINUX_OS
+        struct mmsghdr{
+            struct msghdr  msg_hdr;
+            unsigned int   msg_len;
+        };
+    #endif
+
+    class Checksum{
+        public:
+           static uint32_t  partial(const void* buff, size_t len,
+                                    uint32_t sum=0)                           noexcept(true);
+           static uint16_t  fold(uint32_t sum)                               noexcept(true);
+           static uint16_t  compute(const void* buff, size_t len)            noexcept(true);
+           static uint16_t  update(uint16_t cksum, uint16_t oldWord,
+                                   uint16_t newWord)                         noexcept(true);
+           static uint16_t  update(uint16_t cksum, const void* oldBuff,
+                                   const void* newBuff, size_t len)          noexcept(true);
+    };
+
+    class FastRng{
+        public:
+           explicit FastRng(uint64_t seed);
+           uint64_t next(void)                                                noexcept(true);
+           void     fill(uint8_t* buff, size_t len)                           noexcept(true);
+
+           static FastRng&  local(void)                                       noexcept(false);
+           static uint64_t  mix(uint64_t val)                                 noexcept(true);
+
+        private:
+           std::array<uint64_t, RNDLANES>                 s0,
+                                                          s1,
+                                                          s2,
+                                                          s3,
+                                                          out;
+           size_t                                         used;
+
+           void     step(uint64_t* dst)                                       noexcept(true);
+    };
+
+    class PayloadPool{
+        public:
+           const uint8_t*  pick(size_t len, uint32_t& sum)            const   noexcept(false);
+
+           static const PayloadPool&  get(void)                               noexcept(false);
+
+        private:
+           std::vector<uint8_t>                           data;
+           std::vector<uint64_t>                          prefix;
+
+                    PayloadPool(void);
+    };
+
+    class LatencyHist{
+        public:
+                    LatencyHist(void);
+           void     record(uint64_t ns)                                       noexcept(true);
+           uint64_t percentile(double pct)                            const   noexcept(true);
+           uint64_t getMax(void)                                      const   noexcept(true);
+           uint64_t getCount(void)                                    const   noexcept(true);
+
+           static std::string  durStr(uint64_t ns)                            noexcept(false);
+
+        private:
+           std::array<std::atomic<uint64_t>, HISTBUCKETS> counts;
+           std::atomic<uint64_t>                          total,
+                                                          maxNs;
+
+           static size_t    index(uint64_t ns)                                noexcept(true);
+           static uint64_t  highest(size_t idx)                               noexcept(true);
+    };
+
+    class Probe;
+    class ScanMatrix;
+
+    class JobStat{
+        public:
+           std::atomic<uint64_t>                          sent,
+                                                          calls,
+                                                          slots,
+                                                          bytes;
+           std::atomic<int64_t>                           start;
+           std::atomic<int>                               queue;
+           std::atomic<double>                            target;
+           std::atomic<int>                               targetUnit;
+           std::atomic<uint64_t>                          missed;
+           std::atomic<int64_t>                           horizon;
+           std::atomic<uint64_t>                          replies;
+           std::atomic<int>                               cpu,
+                                                          node;
+           std::atomic<uint64_t>                          pairsDone,
+                                                          pairsTotal,
+                                                          pairsHot;
+           std::atomic<int64_t>                           launchNs;
+           std::array<std::atomic<uint64_t>, BITSPLD>     kindSent,
+                                                          kindBytes;
+           std::array<std::atomic<uint64_t>, ERRSLOTS>    errors;
+           std::array<std::atomic<uint64_t>, ICMPTYPES>   replyTypes;
+           std::vector<std::shared_ptr<JobStat>>          workers;
+           std::shared_ptr<Probe>                         probe;
+           std::shared_ptr<ScanMatrix>                    matrix;
+
+                    JobStat(void);
+           double   fill(void)                                        const   noexcept(true);
+           double   pps(void)                                         const   noexcept(true);
+           double   bps(void)                                         const   noexcept(true);
+           double   rate(void)                                        const   noexcept(true);
+           void     collect(void)                                             noexcept(true);
+           void     failed(int err)                                           noexcept(true);
+    };
+
+    class TokenBucket{
+        public:
+                    TokenBucket(double rate, double capacity);
+           void     acquire(double tokens)                                    noexcept(true);
+           void     setRate(double rate)                                      noexcept(true);
+
+           static double       parseRate(const std::string& spec, 
+                                         RATEUNIT& unit)                      noexcept(false);
+           static std::string  rateStr(double rate, RATEUNIT unit)            noexcept(false);
+
+        private:
+           double                                         perNs,
+                                                          capacity,
+                                                          tokens;
+           int64_t                                        last,
+                                                          slack;
+
+           static int64_t  now(void)                                          noexcept(true);
+           static int64_t  calibrate(void)                                    noexcept(true);
+           void            refill(void)                                       noexcept(true);
+    };
    
+    #ifdef HAVE_TXTIME
+        class LaunchSched{
+            public:
+                       LaunchSched(double rate, RATEUNIT unit, int64_t horizonNs);
+               void    attach(std::vector<struct mmsghdr>& msgs)              noexcept(false);
+               void    stamp(std::vector<struct mmsghdr>& msgs, 
+                             size_t first, size_t cnt)                        noexcept(true);
+               size_t  drainErrors(int fd)                                    noexcept(true);
+               int64_t getHorizon(void)                               const   noexcept(true);
+               uint64_t getMissed(void)                               const   noexcept(true);
+
+               static int64_t  now(void)                                      noexcept(true);
+               static void     enable(int fd)                                 noexcept(false);
+
+            private:
+               double                                     nsPerUnit,
+                                                          nextLaunch;
+               RATEUNIT                                   unit;
+               int64_t                                    horizonNs;
+               uint64_t                                   missed;
+               std::vector<uint64_t>                      ctrl;
+        };
+    #endif
+
     typedef struct ip                                     Ip;
     typedef struct icmp                                   Icmp;
     typedef struct ifreq                                  Ifreq;
     typedef struct ifaddrs                                Ifaddrs;
     typedef struct sockaddr_in                            Sockaddr_in;
-    typedef std::tuple<std::thread*, std::string, bool>   bnThread;
+    typedef std::shared_ptr<JobStat>                      JobStatPtr;
+    typedef std::tuple<unsigned long, std::string, 
+                       JobStatPtr>                        jobSnap;
+    typedef std::vector<uint8_t>                          Frame;
+    typedef std::array<uint8_t, ETHER_ADDR_LEN>           HwAddr;
+    typedef std::array<uint8_t, RNDHDRLEN>                IcmpHead;
+    typedef std::tuple<uint16_t, uint8_t, uint16_t>       fuzzEdit;
+    typedef std::tuple<uint64_t, std::function<void(void)>>  timerItem;
+    typedef std::tuple<int64_t, int64_t, PROFILE, double, double, double> phaseItem;
     typedef std::tuple<uint8_t, uint8_t, uint16_t>        codeRange;
+    typedef std::tuple<in_addr_t, int, bool, JobStatPtr>  rxSub;
+    typedef std::tuple<unsigned long, size_t, size_t>     rxItem;
+
+    // A traffic profile compiled once from a scenario file: phases sorted by
+    // start offset, the senders evaluate it against the elapsed time.
+    class Scenario{
+        public:
+                    Scenario(const std::string& path, const std::string& iface,
+                             uint16_t pktSize);
+           double   rateAt(int64_t elapsedNs, size_t& cursor,
+                           int64_t& waitNs)                           const   noexcept(true);
+           double   initial(void)                                     const   noexcept(true);
+           RATEUNIT getUnit(void)                                     const   noexcept(true);
+           int64_t  getLength(void)                                   const   noexcept(true);
+           size_t   getPhases(void)                                   const   noexcept(true);
+           const std::string& getPath(void)                           const   noexcept(true);
+
+        private:
+           std::string                                    path;
+           std::vector<phaseItem>                         phases;
+           RATEUNIT                                       unit;
+           bool                                           unitSet;
+
+           double   parseLevel(const std::string& spec,
+                               const std::string& iface)                      noexcept(false);
+           static int64_t  parseOffset(const std::string& spec)               noexcept(false);
+    };
+
+    // Layout of the stats segment, for external readers: a header followed by
+    // one record per running job. A record is stable while its seq is even
+    // and unchanged across the read.
+    struct StatsHeader{
+           uint32_t                                       magic,
+                                                          version,
+                                                          records,
+                                                          recordSize;
+           int64_t                                        pid;
+           std::atomic<uint64_t>                          updated;
+           std::atomic<uint32_t>                          jobs;
+    };
+
+    struct StatsRecord{
+           std::atomic<uint32_t>                          seq;
+           uint64_t                                       id,
+                                                          sent,
+                                                          bytes,
+                                                          replies;
+           int64_t                                        elapsedNs;
+           uint64_t                                       kindSent[BITSPLD],
+                                                          kindBytes[BITSPLD],
+                                                          errors[ERRSLOTS],
+                                                          replyTypes[ICMPTYPES];
+    };
+
+    class alignas(CACHELINE) JobCtl{
+        public:
+           std::atomic<int>                               state;
+           std::atomic<unsigned long>                     id;
+           std::atomic<bool>                              run;
+           std::atomic<int>                               live;
+           std::atomic<uint64_t>                          deadline;
+
+                    JobCtl(void);
+           bool     running(void)                                     const   noexcept(true);
+           void     setDescr(const std::string& descr)                        noexcept(false);
+
+        private:
+           friend class JobRegistry;
+
+           mutable std::mutex                             coldMtx;
+           std::string                                    descr;
+           JobStatPtr                                     stat;
+    };
+
+    class JobRegistry{
+        public:
+           JobCtl*  acquire(unsigned long id, JobStatPtr stat,
+                            const std::string& descr, int workers=1)          noexcept(false);
+           void     release(JobCtl* ctl)                                      noexcept(true);
+           bool     stop(unsigned long id)                                    noexcept(true);
+           void     stopAll(void)                                             noexcept(true);
+           size_t   size(void)                                        const   noexcept(true);
+           void     waitIdle(size_t keep)                             const   noexcept(false);
+           std::vector<jobSnap>  snapshot(void)                       const   noexcept(false);
+
+        private:
+           std::array<JobCtl, MAXJOBS>                    slots;
+           mutable std::mutex                             idleMtx;
+           mutable std::condition_variable                idleCv;
+    };
+
+    class TimerService{
+        public:
+                    TimerService(void);
+                    ~TimerService(void);
+           uint64_t schedule(int64_t delayNs, 
+                             std::function<void(void)> action)                noexcept(false);
+           bool     cancel(uint64_t token)                                    noexcept(true);
+
+                    TimerService(const TimerService&)                         = delete;
+                    TimerService&  operator=(const TimerService&)             = delete;
+
+        private:
+           #ifdef LINUX_OS
+               int                                        timerFd,
+                                                          wakeFd,
+                                                          pollFd;
+           #else
+               std::condition_variable                    wakeCv;
+           #endif
+           std::mutex                                     mtx;
+           std::multimap<int64_t, timerItem>              pending;
+           uint64_t                                       nextToken;
+           bool                                           stopping;
+           std::thread                                    worker;
+
+           void     loop(void)                                                noexcept(true);
+           void     wake(void)                                                noexcept(true);
+           void     arm(void)                                                 noexcept(true);
+    };
+
+    class SenderPool{
+        public:
+           explicit SenderPool(size_t base);
+                    ~SenderPool(void);
+           void     submit(std::function<void(void)> task)                    noexcept(false);
+           size_t   getThreads(void)                                  const   noexcept(true);
+           size_t   getIdle(void)                                     const   noexcept(true);
+
+                    SenderPool(const SenderPool&)                             = delete;
+                    SenderPool&  operator=(const SenderPool&)                 = delete;
+
+        private:
+           mutable std::mutex                             mtx;
+           std::condition_variable                        cv;
+           std::deque<std::function<void(void)>>          queue;
+           std::vector<std::thread>                       threads;
+           size_t                                         idle;
+           bool                                           stopping;
+
+           void     run(void)                                                 noexcept(true);
+    };
+
+    class Probe{
+        public:
+                    Probe(unsigned long job, double rate);
+           void     poll(int fd, const Ip& tmpl, const Sockaddr_in& sin)      noexcept(true);
+           bool     reply(const Icmp* icmp, size_t len)                       noexcept(true);
+           uint16_t getIdent(void)                                    const   noexcept(true);
+           int64_t  lastRtt(void)                                     const   noexcept(true);
+           uint64_t lost(bool final)                                  const   noexcept(true);
+           std::string  summary(bool final)                           const   noexcept(false);
+
+        private:
+           uint16_t                                       ident;
+           int64_t                                        interval,
+                                                          next;
+           std::atomic<uint32_t>                          seq;
+           std::atomic<uint64_t>                          sent,
+                                                          received,
+                                                          reordered;
+           std::atomic<int64_t>                           highest,
+                                                          latest;
+           std::array<uint8_t, sizeof(Ip) + ICMP_MINLEN 
+                               + 2 * sizeof(uint32_t)
+                               + sizeof(int64_t)>         packet;
+           LatencyHist                                    rtt;
+    };
+
+    class StatsShm{
+        public:
+           typedef std::function<std::vector<jobSnap>(void)>  Source;
+
+                    StatsShm(const std::string& path, Source src);
+                    ~StatsShm(void);
+                    StatsShm(const StatsShm&)                                 = delete;
+                    StatsShm& operator=(const StatsShm&)                      = delete;
+           const std::string&  getPath(void)                          const   noexcept(true);
+
+        private:
+           std::string                                    path;
+           int                                            fd;
+           size_t                                         len;
+           uint8_t                                        *base;
+           std::atomic<bool>                              running;
+           Source                                         source;
+           std::thread                                    publisher;
+
+           void     publishLoop(void)                                         noexcept(true);
+           void     publish(void)                                             noexcept(false);
+    };
+
+    // A slot of the log ring. Producers own it while seq equals their claim
+    // position, the consumer once seq is one past it.
+    struct LogRecord{
+           std::atomic<size_t>                            seq;
+           uint8_t                                        kind;
+           bool                                           prompt;
+           uint32_t                                       len,
+                                                          total;
+           size_t                                         begin,
+                                                          end;
+           char                                           header[LOGHDRSIZE];
+           uint8_t                                        data[LOGDATASIZE];
+    };
+
+    class LogRing{
+        public:
+                    LogRing(std::mutex& screen, const char* prompt);
+                    ~LogRing(void);
+                    LogRing(const LogRing&)                                   = delete;
+                    LogRing& operator=(const LogRing&)                        = delete;
+           bool     text(const std::string& msg, bool prm)                    noexcept(true);
+           bool     dump(const char* header, const uint8_t* buff, size_t len,
+                         size_t begin, size_t end)                            noexcept(true);
+           uint64_t getDrops(void)                                    const   noexcept(true);
+           void     setFile(const std::string& path)                          noexcept(false);
+           std::string  getFile(void)                                 const   noexcept(false);
+
+        private:
+           std::unique_ptr<LogRecord[]>                   slots;
+           std::atomic<size_t>                            head;
+           size_t                                         tail;
+           std::atomic<uint64_t>                          drops;
+           std::atomic<bool>                              running,
+                                                          sleeping;
+           std::mutex                                     wakeMtx;
+           std::condition_variable                        wakeCv;
+           std::mutex                                     &screenMtx;
+           const char                                     *prompt;
+           mutable std::mutex                             fileMtx;
+           std::ofstream                                  file;
+           std::string                                    filePath;
+           std::thread                                    consumer;
+
+           LogRecord*  claim(size_t& pos)                                     noexcept(true);
+           void        publish(LogRecord& rec, size_t pos)                    noexcept(true);
+           void        consumeLoop(void)                                      noexcept(true);
+           void        render(const LogRecord& rec)                           noexcept(false);
+    };
+
+    // Single producer capture ring: one per sender worker plus one for the
+    // rx worker. A full ring drops the packet.
+    class PcapRing{
+        public:
+           explicit PcapRing(uint32_t snap);
+           void     push(const uint8_t* buff, size_t len, int64_t ns)         noexcept(true);
+           void     push(const struct msghdr& msg, int64_t ns, 
+                         PCAPFIX fix=PCAPASIS)                                noexcept(true);
+           size_t   drain(std::vector<uint8_t>& out, size_t room)             noexcept(false);
+           void     close(void)                                               noexcept(true);
+           uint64_t getDrops(void)                                    const   noexcept(true);
+
+        private:
+           uint32_t                                       snap;
+           std::vector<uint8_t>                           data;
+           std::vector<uint32_t>                          caps,
+                                                          origs;
+           std::vector<int64_t>                           stamps;
+           std::atomic<size_t>                            head,
+                                                          tail;
+           std::atomic<uint64_t>                          drops;
+           std::atomic<bool>                              open;
+    };
+
+    class PcapWriter{
+        public:
+                    PcapWriter(const std::string& path, int dir, uint32_t snap);
+                    ~PcapWriter(void);
+                    PcapWriter(const PcapWriter&)                             = delete;
+                    PcapWriter& operator=(const PcapWriter&)                  = delete;
+           std::shared_ptr<PcapRing>  attach(int which)                       noexcept(false);
+           void     stop(void)                                                noexcept(true);
+           const std::string&  getPath(void)                          const   noexcept(true);
+           int      getDir(void)                                      const   noexcept(true);
+           uint32_t getSnap(void)                                     const   noexcept(true);
+           uint64_t getDrops(void)                                    const   noexcept(false);
+           uint64_t getWritten(void)                                  const   noexcept(true);
+
+        private:
+           std::string                                    path;
+           int                                            dir,
+                                                          fd;
+           uint32_t                                       snap;
+           mutable std::mutex                             ringsMtx;
+           std::vector<std::shared_ptr<PcapRing>>         rings;
+           std::atomic<uint64_t>                          retired,
+                                                          written;
+           std::atomic<bool>                              running;
+           std::vector<uint8_t>                           buff;
+           std::thread                                    writer;
+
+           void     writeLoop(void)                                           noexcept(true);
+           void     flush(void)                                               noexcept(true);
+    };
+
+    // A capture mapped read only: packets are sent straight from the mapping.
+    class PcapFile{
+        public:
+           explicit PcapFile(const std::string& path);
+                    ~PcapFile(void);
+                    PcapFile(const PcapFile&)                                 = delete;
+                    PcapFile& operator=(const PcapFile&)                      = delete;
+           bool     next(size_t& off, const uint8_t*& pkt, uint32_t& len,
+                         int64_t& ns)                                 const   noexcept(true);
+           size_t   getSize(void)                                     const   noexcept(true);
+
+        private:
+           int                                            fd;
+           const uint8_t                                  *base;
+           size_t                                         len;
+           bool                                           swapped,
+                                                          nanos;
+           size_t                                         l2;
+
+           uint32_t word(size_t off)                                  const   noexcept(true);
+    };
+
+    // One cell of the scan matrix: a (type, code, payload variant) probe.
+    // Reply codes are keyed by reply type << 8 | reply code.
+    struct ScanCell{
+           uint16_t                                       length;
+           uint64_t                                       sent,
+                                                          errors,
+                                                          replies;
+           int64_t                                        firstSent,
+                                                          firstReply;
+           std::map<uint16_t, uint64_t>                   replyCodes;
+    };
+
+    typedef std::array<ScanCell, BITSPLD>                 ScanRow;
+
+    class ScanMatrix{
+        public:
+                    ScanMatrix(const std::string& path, size_t lanes);
+                    ~ScanMatrix(void);
+                    ScanMatrix(const ScanMatrix&)                             = delete;
+                    ScanMatrix& operator=(const ScanMatrix&)                  = delete;
+           void     begin(size_t lane, uint8_t type, uint8_t code, 
+                          const std::vector<Frame>& frames,
+                          const std::vector<PAYLOAD>& kinds)                  noexcept(false);
+           void     sent(size_t lane, 
+                         const std::array<uint64_t, BITSPLD>& cnt)            noexcept(true);
+           void     failed(size_t lane, PAYLOAD kind)                         noexcept(true);
+           void     reply(const uint8_t* icmp, size_t len, int orig)          noexcept(true);
+           void     hold(uint16_t key)                                        noexcept(false);
+           void     settle(uint16_t key)                                      noexcept(false);
+           void     sample(size_t lane, int64_t rttNs)                        noexcept(false);
+           int64_t  baseline(void)                                            noexcept(false);
+           bool     reacted(uint16_t key, int64_t base)                       noexcept(false);
+           void     finish(void)                                              noexcept(true);
+           const std::string&  getPath(void)                          const   noexcept(true);
+
+        private:
+           std::string                                    path;
+           SCANOUT                                        format;
+           std::ofstream                                  out;
+           std::mutex                                     mtx;
+           std::condition_variable                        cv;
+           std::map<uint16_t, ScanRow>                    rows;
+           std::array<int, 256>                           lastCode;
+           std::vector<ScanRow*>                          live;
+           std::vector<int>                               current;
+           std::deque<std::pair<uint16_t, int64_t>>       pending;
+           std::set<uint16_t>                             held;
+           std::map<uint16_t, int64_t>                    targetRtt;
+           bool                                           done;
+           size_t                                         written;
+           std::thread                                    writer;
+
+           void         enqueue(uint16_t key, int64_t now)                    noexcept(false);
+           void         writeLoop(void)                                       noexcept(true);
+           std::string  render(uint16_t key, const ScanRow& row)              noexcept(false);
+    };
 
     #ifdef LINUX_OS
+        class RxFilter{
+            public:
+               typedef std::vector<struct sock_filter>    Program;
+
+               static Program  build(const std::set<in_addr_t>& peers,
+                                     const std::set<int>& types)              noexcept(false);
+               static Program  dropAll(void)                                  noexcept(false);
+               static void     attach(int fd, Program& prog)                  noexcept(false);
+               static uint64_t icmpInMsgs(void)                               noexcept(true);
+        };
+    #endif
+
+    class RxWorker{
+        public:
+           typedef std::function<void(unsigned long, const std::vector<uint8_t>&, size_t)>  Printer;
+
+                    RxWorker(Printer prn);
+                    ~RxWorker(void);
+                    RxWorker(const RxWorker&)                                 = delete;
+                    RxWorker& operator=(const RxWorker&)                      = delete;
+           void     subscribe(unsigned long id, in_addr_t dst, int type,
+                              bool print, JobStatPtr stat)                     noexcept(false);
+           void     unsubscribe(unsigned long id)                             noexcept(true);
+           void     capture(std::shared_ptr<PcapRing> ring)                   noexcept(true);
+           uint64_t getOrphans(void)                                  const   noexcept(true);
+           uint64_t getFiltered(void)                                 const   noexcept(true);
+           static int replyType(int reqType)                                  noexcept(true);
+
+        private:
+           int                                            fd;
+           std::atomic<bool>                              running;
+           std::atomic<uint64_t>                          orphans,
+                                                          received;
+           uint64_t                                       icmpBase;
+           Printer                                        printer;
+           std::mutex                                     subMtx,
+                                                          poolMtx;
+           std::condition_variable                        poolCv;
+           std::map<unsigned long, rxSub>                 subs;
+           std::shared_ptr<PcapRing>                      pcap;
+           std::vector<std::vector<uint8_t>>              pool;
+           std::vector<size_t>                            freeBufs;
+           std::deque<rxItem>                             printQueue;
+           std::thread                                    worker,
+                                                          printerTh;
+
+           void     receiveLoop(void)                                         noexcept(true);
+           void     printLoop(void)                                           noexcept(true);
+           bool     dispatch(size_t buf, size_t len)                          noexcept(true);
+           void     release(size_t buf)                                       noexcept(true);
+           void     refilter(void)                                            noexcept(true);
+    };
+
+    #ifdef LINUX_OS
+        class Placement{
+            public:
+               static std::vector<int>  parseList(const std::string& spec)    noexcept(false);
+               static std::vector<int>  onlineCpus(void)                      noexcept(false);
+               static std::vector<int>  nodeCpus(int node)                    noexcept(false);
+               static int               ifaceNode(const std::string& iface)   noexcept(true);
+               static void              pin(const std::vector<int>& cpus)     noexcept(false);
+               static void              preferNode(int node)                  noexcept(true);
+               static void              unpin(const cpu_set_t& home)          noexcept(true);
+        };
+
         class Capability{
             public:
                    explicit  Capability(bool noRoot);
@@ -109,6 +807,80 @@ namespace wh{
                std::string errorMessage;
         };
 
+        class TxRing{
+            public:
+                   TxRing(const std::string& iface, bool qdiscBypass,
+                          size_t maxFrame)                                    noexcept(false);
+                   ~TxRing(void);
+                   TxRing(const TxRing&)                                      = delete;
+                   TxRing&   operator=(const TxRing&)                         = delete;
+                   int       getFd(void)                               const  noexcept(true);
+                   bool      bypassActive(void)                        const  noexcept(true);
+                   HwAddr    getHwAddr(void)                           const  noexcept(true);
+                   uint64_t  getWrongFormat(void)                      const  noexcept(true);
+                   void      load(std::vector<Frame>& linkFrames)             noexcept(false);
+                   size_t    send(size_t first, size_t cnt)                   noexcept(true);
+
+            private:
+                   int                       sockFd;
+                   bool                      bypass;
+                   uint8_t                   *ring;
+                   size_t                    ringLen;
+                   uint32_t                  frameSize,
+                                             frameNr,
+                                             current;
+                   uint64_t                  wrongFormat;
+                   HwAddr                    hwAddr;
+                   std::vector<Frame>        frames;
+                   std::vector<uint32_t>     loaded;
+        };
+
+        #ifdef HAVE_AFXDP
+        class XskSocket{
+            public:
+                   XskSocket(const std::string& iface, uint32_t queueId,
+                             size_t maxFrame)                                 noexcept(false);
+                   ~XskSocket(void);
+                   XskSocket(const XskSocket&)                                = delete;
+                   XskSocket& operator=(const XskSocket&)                     = delete;
+                   int       getFd(void)                               const  noexcept(true);
+                   bool      zeroCopy(void)                            const  noexcept(true);
+                   uint32_t  getQueue(void)                            const  noexcept(true);
+                   HwAddr    getHwAddr(void)                           const  noexcept(true);
+                   void      load(std::vector<Frame>& linkFrames)             noexcept(false);
+                   size_t    send(size_t first, size_t cnt)                   noexcept(true);
+
+            private:
+                   struct XskRing{
+                       uint32_t   *producer,
+                                  *consumer,
+                                  *flags;
+                       void       *descs;
+                       uint32_t   cached;
+                       void       *map;
+                       size_t     mapLen;
+                   };
+
+                   int                       sockFd;
+                   bool                      zc;
+                   uint32_t                  queue;
+                   uint8_t                   *umem;
+                   size_t                    umemLen;
+                   uint32_t                  outstanding;
+                   HwAddr                    hwAddr;
+                   XskRing                   txr,
+                                             cqr;
+                   std::vector<uint32_t>     lens;
+
+                   void      mapRing(XskRing& ring, const struct xdp_ring_offset& off,
+                                     size_t descSize, bool hasFlags,
+                                     off_t pgoff)                             noexcept(false);
+                   void      complete(void)                                   noexcept(true);
+                   void      kick(void)                                       noexcept(true);
+                   void      release(void)                                    noexcept(true);
+        };
+        #endif
+
     #endif
     
     class Env{
@@ -118,23 +890,130 @@ namespace wh{
            SCANMODE                                       scanmode;
            uint32_t                                       maxPktSent;
            uint16_t                                       maxPktSize;
+           uint16_t                                       batch;
            useconds_t                                     thTimeo;
            Ip                                             *ip;
            Icmp                                           *icmp;
            Ifreq                                          ifr;
            std::bitset<BITSPLD>                           payload;  
+           bool                                           rndPayload;
            bool                                           printIncoming;
+           BACKEND                                        backend;
+           bool                                           qdiscBypass;
+           std::string                                    dstMac;
+           uint32_t                                       xdpQueue;
+           double                                         rate;
+           RATEUNIT                                       rateUnit;
+           uint32_t                                       burst;
+           bool                                           txTime;
+           uint32_t                                       txHorizon;
+           uint16_t                                       workers;
+           double                                         probeRate;
+           AFFINITY                                       affinity;
+           std::vector<int>                               cpuList;
+           bool                                           fuzz;
+           uint64_t                                       fuzzSeed,
+                                                          fuzzFrom;
+           FUZZSTRAT                                      fuzzMode;
+           std::bitset<FZFIELDS>                          fuzzFields;
+           std::shared_ptr<const Scenario>                scenario;
+           std::string                                    scanOut;
+           std::shared_ptr<PcapWriter>                    pcap;
            std::vector<std::string>                       params;
            std::vector<uint8_t>                           packet;
            
            explicit Env(std::string& ifc);
                     Env(const Env& env);
+                    Env(Env&& env)                                            = default;
                     ~Env(void);
            void     setThreadEnv(Sockaddr_in *sin, bool setIcmp)              noexcept(false);
            uint8_t  genRnd(std::vector<uint8_t>  *array,
                            ptrdiff_t start)                           const   noexcept(false);
     };
     
+    class FrameCache{
+        public:
+           explicit FrameCache(const Env& cenv)                               noexcept(false);
+           void     materialise(uint8_t type, uint8_t code, uint16_t stdSize,
+                                std::vector<Frame>& frames,
+                                std::vector<PAYLOAD>& kinds)                  noexcept(false);
+
+        private:
+           Frame                                          templ;
+           std::bitset<BITSPLD>                           payload;
+           uint16_t                                       maxSize;
+           std::map<uint16_t, uint32_t>                   tailSums;
+           uint16_t                                       lastStdSize;
+
+           uint32_t tailSum(uint16_t icmpLen)                                 noexcept(true);
+    };
+
+    class Fuzzer{
+        public:
+                    Fuzzer(uint64_t seed, FUZZSTRAT mode, 
+                           const std::bitset<FZFIELDS>& fields)               noexcept(false);
+           void     mutate(Frame& fr, uint64_t seq, 
+                           std::vector<fuzzEdit>& edits)              const   noexcept(true);
+           void     revert(Frame& fr, std::vector<fuzzEdit>& edits)   const   noexcept(true);
+
+        private:
+           uint64_t                                       seed;
+           FUZZSTRAT                                      mode;
+           std::vector<FUZZFIELD>                         fields;
+
+           static uint16_t  read(const Frame& fr, size_t off, size_t width)   noexcept(true);
+           static void      write(Frame& fr, size_t off, size_t width, 
+                                  uint16_t val)                               noexcept(true);
+    };
+
+    class TxPath{
+        public:
+           int                                            sockFd,
+                                                          sendFd;
+           Sockaddr_in                                    sin;
+           std::unique_ptr<FrameCache>                    cache;
+           std::vector<Frame>                             frames;
+           std::vector<PAYLOAD>                           kinds;
+           std::shared_ptr<ScanMatrix>                    matrix;
+           std::shared_ptr<PcapRing>                      pcap;
+           size_t                                         lane;
+           std::vector<struct mmsghdr>                    msgs;
+           std::vector<struct iovec>                      iovs;
+           const PayloadPool                              *pool;
+           std::vector<IcmpHead>                          heads;
+           std::unique_ptr<Fuzzer>                        fuzz;
+           std::vector<Frame>                             slots;
+           std::vector<std::vector<fuzzEdit>>             edits;
+           uint64_t                                       seq;
+           size_t                                         next;
+           std::unique_ptr<TokenBucket>                   pacer;
+           int                                            shares;
+           size_t                                         phase;
+           int64_t                                        origin;
+           #ifdef HAVE_TXTIME
+               std::unique_ptr<LaunchSched>               sched;
+           #endif
+           #ifdef LINUX_OS
+               std::unique_ptr<TxRing>                    ring;
+               #ifdef HAVE_AFXDP
+                   std::unique_ptr<XskSocket>             xsk;
+               #endif
+               std::vector<Frame>                         linkFrames;
+               HwAddr                                     srcHwAddr,
+                                                          dstHwAddr;
+           #endif
+
+                    TxPath(void);
+                    ~TxPath(void);
+           size_t   bytes(size_t first, size_t cnt)                   const   noexcept(true);
+           void     account(size_t first, size_t cnt, 
+                            JobStat& stat)                            const   noexcept(true);
+           void     randomise(size_t first, size_t cnt)                       noexcept(false);
+           void     mutate(size_t first, size_t cnt)                          noexcept(true);
+                    TxPath(const TxPath&)                                     = delete;
+                    TxPath&  operator=(const TxPath&)                         = delete;
+    };
+
     class Wh{
         public: 
            void  shellLoop(void);
@@ -151,38 +1030,99 @@ namespace wh{
            const char*                                   prompt;
            size_t                                        currParam;
            Env                                           env;
-           std::map<unsigned long, bnThread>             threadsList;
+           JobRegistry                                   jobs;
            const std::map<std::string, SCANMODE>         scanModes;
            const std::map<SCANMODE, std::string>         scanModesDescr;
+           const std::map<std::string, BACKEND>          backends;
+           const std::map<BACKEND, std::string>          backendsDescr;
            const std::map<std::string, uint8_t>          opts;
+           const std::map<std::string, FUZZSTRAT>        fuzzModes;
+           const std::map<FUZZSTRAT, std::string>        fuzzModesDescr;
+           const std::map<std::string, 
+                          std::bitset<FZFIELDS>>         fuzzFieldSets;
            const std::map<std::string,  
                           std::function<int(void)>>      commands,
                                                          setCmds,
                                                          ploadCmds;
            const std::map<uint8_t, codeRange>            icmpType;
            std::map<uint8_t, codeRange>                  icmpTypeFull;
+           std::array<uint16_t, 256>                     stdSizes;
+           std::unique_ptr<RxWorker>                     rx;
+           mutable std::mutex                            rxMtx;
+           mutable std::atomic<unsigned long>            cpuSlot;
+           std::unique_ptr<StatsShm>                     shm;
+           unsigned long                                 monitorGen;
+           std::mutex                                    monitorMtx;
+           std::condition_variable                       monitorCv;
+           std::thread                                   monitor;
+           std::unique_ptr<LogRing>                      log;
+           TimerService                                  timers;
+           SenderPool                                    senders;
     
            inline bool   sendpk(const int fd, const uint8_t* buff, 
                                 const size_t bufflen, const sockaddr* sin,
                                 useconds_t pause)                          const   noexcept(true); 
+           size_t        sendBatch(const int fd, 
+                                   std::vector<struct mmsghdr>& msgs,
+                                   size_t first, size_t cnt, useconds_t pause, 
+                                   JobStat& stat)                          const   noexcept(true);
+           void          setupBatch(std::vector<Frame>& frames, Sockaddr_in* sin,
+                                    std::vector<struct mmsghdr>& msgs,
+                                    std::vector<struct iovec>& iovs)       const   noexcept(false);
+           void          openTx(Env& cenv, TxPath& tx)                     const   noexcept(false);
+           void          prepareTx(Env& cenv, uint8_t type, uint8_t code,
+                                   TxPath& tx)                             const   noexcept(false);
+           size_t        transmit(Env& cenv, TxPath& tx, size_t cnt,
+                                  useconds_t pause, JobStat& stat)         const   noexcept(true);
+           bool          follow(Env& cenv, TxPath& tx, const JobCtl& ctl,
+                                  JobStat& stat)                           const   noexcept(true);
+           uint32_t      ringLoop(Env& cenv, TxPath& tx, const JobCtl& ctl,
+                                  uint32_t maxCount, useconds_t pause,
+                                  JobStat& stat, Probe* probe=nullptr)             noexcept(false);
+           void          attachRx(unsigned long id, Env& cenv, int type,
+                                  JobStatPtr stat)                                 noexcept(false);
+           void          detachRx(unsigned long id)                                noexcept(true);
+           #ifdef LINUX_OS
+               void      placeThread(Env& cenv, JobStat& stat)             const   noexcept(false);
+               void      resolveHwAddr(Env& cenv, TxPath& tx)              const   noexcept(false);
+               void      buildLinkFrames(Env& cenv, TxPath& tx)            const   noexcept(false);
+           #endif
+           int           setBatchSize(std::string& size)                           noexcept(true);
+           int           setBackend(std::string& mode)                             noexcept(true);
+           int           setQdiscBypass(std::string& mode)                         noexcept(true);
+           int           setTxTime(std::string& mode)                              noexcept(true);
+           int           setAffinity(std::string& mode)                            noexcept(true);
            void          getLocalIp(void)                                          noexcept(false);
            void          resetIpHdr(void)                                          noexcept(false);
-           uint16_t      checksum(void *buff, size_t len)                  const   noexcept(true);
            int           parseCommand(CMDTYPE type)                        const   noexcept(false);
            int           setPayloadMode(std::string& mode, PAYLOAD type)           noexcept(true);
+           int           setRandomPayload(std::string& mode)                       noexcept(true);
            int           setPrintMode(std::string& mode)                           noexcept(true);
            int           setScanMode(std::string& mode)                            noexcept(true);
            int           setDebugMode(std::string& mode)                           noexcept(true);
            void          addScanThread(void)                                       noexcept(false);
            void          addJobThread(void)                                        noexcept(false);
+           void          addReplayThread(void)                                     noexcept(false);
            void          killThread(void)                                          noexcept(true);
            bool          chkPrno(PARAMS num)                               const   noexcept(true);
+           bool          chkPrno(PARAMS num, PARAMS max)                   const   noexcept(true);
+           bool          setJobOpts(PARAMS first, bool fuzz=false)                 noexcept(true);
            void          printStatus(void)                                 const   noexcept(true);
            void          printHelp(void)                                   const   noexcept(true);
            void          printList(void)                                   const   noexcept(true);
+           void          statsCmd(void)                                            noexcept(true);
+           void          stopMonitor(void)                                         noexcept(true);
+           void          printStats(unsigned long id, bool all,
+                                    std::map<unsigned long, 
+                                             std::pair<uint64_t, uint64_t>>* prev,
+                                    unsigned int interval)                 const   noexcept(true);
+           int           setStatsShm(std::string& mode)                            noexcept(true);
+           int           setLogFile(std::string& mode)                             noexcept(true);
+           int           setPcap(void)                                             noexcept(true);
            void          printPromptErr(std::string&& msg, bool prm=false) const   noexcept(true);
            int           openRSocket(Env& cenv)                            const   noexcept(false);
-           std::string   getStatus(JOBTYPE type, Env& cenv)                const   noexcept(false);
+           std::string   getStatus(JOBTYPE type, Env& cenv,
+                                   const TxPath* tx=nullptr)               const   noexcept(false);
            void          trace(std::string& header, 
                                const std::vector<uint8_t>* buff,
                                size_t begin, size_t end, size_t max)       const   noexcept(true);
@@ -77,17 +77,2782 @@ namespace wh{
            return errorMessage;
        }
 
+       static int ifHwInfo(const string& iface, HwAddr& hwAddr){
+           int    fd        = socket(AF_INET, SOCK_DGRAM, 0);
+           if(fd == -1) return -1;
+
+           Ifreq  ifr;
+           int    ifIndex   = -1;
+           memset(&ifr, 0, sizeof(ifr));
+           strncpy(ifr.ifr_name, iface.c_str(), IFNAMSIZ-1);
+           if(ioctl(fd, SIOCGIFINDEX, &ifr) != -1){
+               ifIndex      = ifr.ifr_ifindex;
+               if(ioctl(fd, SIOCGIFHWADDR, &ifr) != -1)
+                   memcpy(hwAddr.data(), ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+               else
+                   ifIndex  = -1;
+           }
+           close(fd);
+           return ifIndex;
+       }
+
+       TxRing::TxRing(const string& iface, bool qdiscBypass, size_t maxFrame) 
+                            : sockFd{socket(AF_PACKET, SOCK_RAW, 0)}, bypass{false}, ring{nullptr}, 
+                              ringLen{0},  frameSize{TXFRAMEMIN},    frameNr{0},     current{0}, 
+                              wrongFormat{0}, hwAddr()
+       {
+           if(sockFd == -1)
+               throw WhException(string("TxRing: Socket Creation Error: ") + strerror(errno));
+
+           auto fail  = [&](const char* msg){
+                            string err = string("TxRing: ") + msg + ": " + strerror(errno);
+                            if(ring != nullptr) munmap(ring, ringLen);
+                            close(sockFd);
+                            throw WhException(err);
+                        };
+
+           int    ifIndex   = ifHwInfo(iface, hwAddr);
+           if(ifIndex == -1) fail("Error reading iface index/hw address");
+
+           int    version   = TPACKET_V2,
+                  lossOn    = 1;
+           if(setsockopt(sockFd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+               fail("Socket Conf. Error (PACKET_VERSION)");
+           if(setsockopt(sockFd, SOL_PACKET, PACKET_LOSS, &lossOn, sizeof(lossOn)) == -1)
+               fail("Socket Conf. Error (PACKET_LOSS)");
+           // Kernels older than 3.14 don't know the option: stay on the qdisc path.
+           #ifdef PACKET_QDISC_BYPASS
+               int  bypassOn  = 1;
+               if(qdiscBypass)
+                   bypass = setsockopt(sockFd, SOL_PACKET, PACKET_QDISC_BYPASS, &bypassOn, sizeof(bypassOn)) == 0;
+           #else
+               static_cast<void>(qdiscBypass);
+           #endif
+
+           while(frameSize < maxFrame + TPACKET2_HDRLEN)
+               frameSize <<= 1;
+           uint32_t           blockSize = frameSize > TXBLOCKSIZE ? frameSize : static_cast<uint32_t>(TXBLOCKSIZE);
+           struct tpacket_req req;
+           req.tp_block_size = blockSize;
+           req.tp_block_nr   = TXBLOCKNR;
+           req.tp_frame_size = frameSize;
+           req.tp_frame_nr   = (blockSize / frameSize) * TXBLOCKNR;
+           if(setsockopt(sockFd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1)
+               fail("Socket Conf. Error (PACKET_TX_RING)");
+
+           frameNr           = req.tp_frame_nr;
+           ringLen           = static_cast<size_t>(blockSize) * TXBLOCKNR;
+           void* map         = mmap(nullptr, ringLen, PROT_READ | PROT_WRITE, MAP_SHARED, sockFd, 0);
+           if(map == MAP_FAILED) fail("Error mapping the tx ring");
+           ring              = static_cast<uint8_t*>(map);
+
+           struct sockaddr_ll  sll;
+           memset(&sll, 0, sizeof(sll));
+           sll.sll_family    = AF_PACKET;
+           sll.sll_ifindex   = ifIndex;
+           if(bind(sockFd, reinterpret_cast<sockaddr*>(&sll), sizeof(sll)) == -1)
+               fail("Error binding the iface");
+       }
+
+       TxRing::~TxRing(void){
+           if(ring != nullptr) munmap(ring, ringLen);
+           close(sockFd);
+       }
+
+       int TxRing::getFd(void) const noexcept(true){
+           return sockFd;
+       }
+
+       bool TxRing::bypassActive(void) const noexcept(true){
+           return bypass;
+       }
+
+       HwAddr TxRing::getHwAddr(void) const noexcept(true){
+           return hwAddr;
+       }
+
+       uint64_t TxRing::getWrongFormat(void) const noexcept(true){
+           return wrongFormat;
+       }
+
+       void TxRing::load(vector<Frame>& linkFrames) noexcept(false){
+           for(const auto& fr : linkFrames)
+               if(fr.size() > frameSize - (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll)))
+                   throw WhException("TxRing: frame exceeds ring slot size.");
+           frames    = linkFrames;
+           loaded.assign(frameNr, UINT32_MAX);
+       }
+
+       size_t TxRing::send(size_t first, size_t cnt) noexcept(true){
+           size_t  pushed   = 0;
+
+           // Slots keep the frame they were loaded with: the variants cycle, so
+           // most of the time a free slot only needs its length and status.
+           while(pushed < cnt){
+               uint8_t              *base   = ring + static_cast<size_t>(current) * frameSize;
+               struct tpacket2_hdr  *hdr    = reinterpret_cast<struct tpacket2_hdr*>(base);
+               uint32_t             status  = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+
+               if(status == TP_STATUS_WRONG_FORMAT) wrongFormat++;
+               else if(status != TP_STATUS_AVAILABLE) break;
+
+               uint32_t      idx    = static_cast<uint32_t>((first + pushed) % frames.size());
+               const Frame&  fr     = frames[idx];
+               if(loaded[current] != idx){
+                   memcpy(base + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll), fr.data(), fr.size());
+                   loaded[current]  = idx;
+               }
+               hdr->tp_len          = static_cast<uint32_t>(fr.size());
+               __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+               current              = (current + 1) % frameNr;
+               pushed++;
+           }
+
+           // With a full ring wait for the kernel to drain it, otherwise just kick.
+           ::send(sockFd, nullptr, 0, pushed < cnt ? 0 : MSG_DONTWAIT);
+           return pushed;
+       }
+
+       #ifdef HAVE_AFXDP
+
+       XskSocket::XskSocket(const string& iface, uint32_t queueId, size_t maxFrame)
+                            : sockFd{socket(AF_XDP, SOCK_RAW, 0)}, zc{false},   queue{queueId},
+                              umem{nullptr}, umemLen{static_cast<size_t>(XSKCHUNKSIZE) * XSKMAXFRAMES}, 
+                              outstanding{0}, hwAddr(), txr(), cqr(), lens()
+       {
+           if(sockFd == -1)
+               throw WhException(string("XskSocket: Socket Creation Error: ") + strerror(errno));
+
+           try{
+               auto fail  = [&](const char* msg){
+                                throw WhException(string("XskSocket: ") + msg + ": " + strerror(errno));
+                            };
+
+               if(maxFrame > XSKCHUNKSIZE){
+                   errno       = EMSGSIZE;
+                   fail("maxpktsize exceeds the umem chunk");
+               }
+
+               int  ifIndex    = ifHwInfo(iface, hwAddr);
+               if(ifIndex == -1) fail("Error reading iface index/hw address");
+
+               void *area      = mmap(nullptr, umemLen, PROT_READ | PROT_WRITE, 
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+               if(area == MAP_FAILED) fail("Error allocating the umem");
+               umem            = static_cast<uint8_t*>(area);
+
+               struct xdp_umem_reg  mr;
+               memset(&mr, 0, sizeof(mr));
+               mr.addr         = reinterpret_cast<uintptr_t>(umem);
+               mr.len          = umemLen;
+               mr.chunk_size   = XSKCHUNKSIZE;
+               if(setsockopt(sockFd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) == -1)
+                   fail("Socket Conf. Error (XDP_UMEM_REG)");
+
+               // The fill ring is unused by a transmit only socket, but bind() requires it.
+               int  ringSize   = XSKRINGSIZE;
+               if(setsockopt(sockFd, SOL_XDP, XDP_UMEM_FILL_RING, &ringSize, sizeof(ringSize)) == -1 ||
+                  setsockopt(sockFd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringSize, sizeof(ringSize)) == -1 ||
+                  setsockopt(sockFd, SOL_XDP, XDP_TX_RING, &ringSize, sizeof(ringSize)) == -1)
+                   fail("Socket Conf. Error (ring sizes)");
+
+               struct xdp_mmap_offsets  off;
+               socklen_t                optlen = sizeof(off);
+               if(getsockopt(sockFd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1)
+                   fail("Socket Conf. Error (XDP_MMAP_OFFSETS)");
+               bool hasFlags   = optlen == sizeof(off);
+               mapRing(txr, off.tx, sizeof(struct xdp_desc), hasFlags, XDP_PGOFF_TX_RING);
+               mapRing(cqr, off.cr, sizeof(uint64_t),        hasFlags, 
+                       static_cast<off_t>(XDP_UMEM_PGOFF_COMPLETION_RING));
+
+               // Zero-copy when the driver supports it, then copy mode (generic path, veth included).
+               const uint16_t       modes[] = { XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP, 
+                                                XDP_COPY     | XDP_USE_NEED_WAKEUP, XDP_COPY };
+               struct sockaddr_xdp  sxdp;
+               bool                 bound   = false;
+               memset(&sxdp, 0, sizeof(sxdp));
+               sxdp.sxdp_family     = AF_XDP;
+               sxdp.sxdp_ifindex    = static_cast<uint32_t>(ifIndex);
+               sxdp.sxdp_queue_id   = queue;
+               for(const auto mode : modes){
+                   sxdp.sxdp_flags  = mode;
+                   if(bind(sockFd, reinterpret_cast<sockaddr*>(&sxdp), sizeof(sxdp)) == 0){
+                       bound        = true;
+                       zc           = (mode & XDP_ZEROCOPY) != 0;
+                       break;
+                   }
+               }
+               if(!bound) fail("Error binding the iface queue");
+
+               txr.cached      = *txr.producer;
+               cqr.cached      = *cqr.consumer;
+           }catch(...){
+               release();
+               throw;
+           }
+       }
+
+       XskSocket::~XskSocket(void){
+           release();
+       }
+
+       void XskSocket::release(void) noexcept(true){
+           if(txr.map != nullptr) munmap(txr.map, txr.mapLen);
+           if(cqr.map != nullptr) munmap(cqr.map, cqr.mapLen);
+           if(umem    != nullptr) munmap(umem, umemLen);
+           txr.map   = cqr.map  = nullptr;
+           umem      = nullptr;
+           if(sockFd != -1) close(sockFd);
+           sockFd    = -1;
+       }
+
+       void XskSocket::mapRing(XskRing& ring, const struct xdp_ring_offset& off, size_t descSize, 
+                               bool hasFlags, off_t pgoff) noexcept(false){
+           size_t  len    = off.desc + XSKRINGSIZE * descSize;
+           void    *map   = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, sockFd, pgoff);
+           if(map == MAP_FAILED)
+               throw WhException(string("XskSocket: Error mapping a ring: ") + strerror(errno));
+
+           uint8_t *base  = static_cast<uint8_t*>(map);
+           ring.map       = map;
+           ring.mapLen    = len;
+           ring.producer  = reinterpret_cast<uint32_t*>(base + off.producer);
+           ring.consumer  = reinterpret_cast<uint32_t*>(base + off.consumer);
+           ring.flags     = hasFlags ? reinterpret_cast<uint32_t*>(base + off.flags) : nullptr;
+           ring.descs     = base + off.desc;
+       }
+
+       int XskSocket::getFd(void) const noexcept(true){
+           return sockFd;
+       }
+
+       bool XskSocket::zeroCopy(void) const noexcept(true){
+           return zc;
+       }
+
+       uint32_t XskSocket::getQueue(void) const noexcept(true){
+           return queue;
+       }
+
+       HwAddr XskSocket::getHwAddr(void) const noexcept(true){
+           return hwAddr;
+       }
+
+       void XskSocket::complete(void) noexcept(true){
+           uint32_t  done   = __atomic_load_n(cqr.producer, __ATOMIC_ACQUIRE) - cqr.cached;
+           if(done > 0){
+               cqr.cached  += done;
+               __atomic_store_n(cqr.consumer, cqr.cached, __ATOMIC_RELEASE);
+               outstanding -= done;
+           }
+       }
+
+       void XskSocket::kick(void) noexcept(true){
+           if(txr.flags == nullptr || (__atomic_load_n(txr.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP))
+               sendto(sockFd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+       }
+
+       void XskSocket::load(vector<Frame>& linkFrames) noexcept(false){
+           if(linkFrames.size() > XSKMAXFRAMES)
+               throw WhException("XskSocket: too many frames for the umem.");
+
+           // Chunks can still be referenced by descriptors in flight.
+           for(int wait = 0; outstanding > 0 && wait < 1000; ++wait){
+               kick();
+               complete();
+               if(outstanding > 0) this_thread::sleep_for(chrono::microseconds(100));
+           }
+
+           lens.clear();
+           for(size_t i = 0; i < linkFrames.size(); ++i){
+               if(linkFrames[i].size() > XSKCHUNKSIZE)
+                   throw WhException("XskSocket: frame exceeds the umem chunk.");
+               memcpy(umem + i * XSKCHUNKSIZE, linkFrames[i].data(), linkFrames[i].size());
+               lens.push_back(static_cast<uint32_t>(linkFrames[i].size()));
+           }
+       }
+
+       size_t XskSocket::send(size_t first, size_t cnt) noexcept(true){
+           complete();
+
+           uint32_t          busy   = txr.cached - __atomic_load_n(txr.consumer, __ATOMIC_ACQUIRE),
+                             room   = min(XSKRINGSIZE - busy, XSKRINGSIZE - outstanding);
+           size_t            num    = min<size_t>(cnt, room);
+           struct xdp_desc   *descs = static_cast<struct xdp_desc*>(txr.descs);
+
+           // Descriptors point to the pre-populated chunks: nothing is copied here.
+           for(size_t i = 0; i < num; ++i){
+               uint32_t          idx  = static_cast<uint32_t>((first + i) % lens.size());
+               struct xdp_desc&  desc = descs[(txr.cached + i) & (XSKRINGSIZE - 1)];
+               desc.addr              = static_cast<uint64_t>(idx) * XSKCHUNKSIZE;
+               desc.len               = lens[idx];
+               desc.options           = 0;
+           }
+           txr.cached  += static_cast<uint32_t>(num);
+           __atomic_store_n(txr.producer, txr.cached, __ATOMIC_RELEASE);
+           outstanding += static_cast<uint32_t>(num);
+
+           kick();
+           return num;
+       }
+
+       #endif
+
+    #endif
+
+    // Block kernels add native 32-bit words into a 64-bit accumulator: the
+    // one's complement sum doesn't depend on word size or byte order, so the
+    // result folds to the same 16-bit value as the word by word loop.
+    // len must be a multiple of 4.
+    #ifdef HAVE_CHKSFMV
+    __attribute__((target("default")))
+    #endif
+    static uint64_t sumBlock(const uint8_t* bytes, size_t len) noexcept(true){
+        uint64_t   sum   = 0;
+        uint32_t   word  = 0;
+
+        for(size_t i = 0; i < len; i += sizeof(word)){
+            memcpy(&word, bytes + i, sizeof(word));
+            sum += word;
+        }
+        return sum;
+    }
+
+    #if defined(HAVE_CHKSFMV)
+
+    __attribute__((target("sse4.2")))
+    static uint64_t sumBlock(const uint8_t* bytes, size_t len) noexcept(true){
+        const __m128i  zero  = _mm_setzero_si128();
+        __m128i        acc   = _mm_setzero_si128();
+        size_t         i     = 0;
+
+        for(; i + 16 <= len; i += 16){
+            __m128i  v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+            acc         = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+            acc         = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+        }
+
+        uint64_t       lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        uint64_t       sum   = lanes[0] + lanes[1];
+        for(uint32_t word = 0; i < len; i += sizeof(word)){
+            memcpy(&word, bytes + i, sizeof(word));
+            sum += word;
+        }
+        return sum;
+    }
+
+    __attribute__((target("avx2")))
+    static uint64_t sumBlock(const uint8_t* bytes, size_t len) noexcept(true){
+        const __m256i  zero  = _mm256_setzero_si256();
+        __m256i        acc   = _mm256_setzero_si256();
+        size_t         i     = 0;
+
+        for(; i + 32 <= len; i += 32){
+            __m256i  v  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i));
+            acc         = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+            acc         = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+        }
+
+        uint64_t       lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        uint64_t       sum   = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for(uint32_t word = 0; i < len; i += sizeof(word)){
+            memcpy(&word, bytes + i, sizeof(word));
+            sum += word;
+        }
+        return sum;
+    }
+
+    #elif defined(HAVE_CHKSNEON)
+
+    static uint64_t sumBlockNeon(const uint8_t* bytes, size_t len) noexcept(true){
+        uint64x2_t     acc   = vdupq_n_u64(0);
+        size_t         i     = 0;
+
+        for(; i + 16 <= len; i += 16)
+            acc   = vpadalq_u32(acc, vreinterpretq_u32_u8(vld1q_u8(bytes + i)));
+
+        uint64_t       sum   = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+        return sum + sumBlock(bytes + i, len - i);
+    }
+
+    #endif
+
+    uint32_t Checksum::partial(const void* buff, size_t len, uint32_t sum) noexcept(true){
+        const uint8_t   *bytes     =  static_cast<const uint8_t*>(buff);
+        size_t          blockLen   =  len & ~static_cast<size_t>(3);
+        uint16_t        word       =  0;
+
+        #ifdef HAVE_CHKSNEON
+        uint64_t        total      =  sum + sumBlockNeon(bytes, blockLen);
+        #else
+        uint64_t        total      =  sum + sumBlock(bytes, blockLen);
+        #endif
+        bytes += blockLen;
+        len   -= blockLen;
+
+        if(len > 1){
+            memcpy(&word, bytes, sizeof(word));
+            total += word;
+            bytes += 2;
+            len   -= 2;
+        }
+
+        if( len == 1 ){
+            word   = 0;
+            *(reinterpret_cast<uint8_t*>(&word)) = *bytes;
+            total += word;
+        }
+
+        while(total >> 16)
+            total = ( total >> 16 ) + ( total & 0xffff );
+        return static_cast<uint32_t>(total);
+    }
+
+    uint16_t Checksum::fold(uint32_t sum) noexcept(true){
+        sum =  ( sum >> 16 ) + ( sum & 0xffff ); 
+        sum += ( sum >> 16 );                   
+        return static_cast<uint16_t>(~sum);
+    }
+
+    uint16_t Checksum::compute(const void* buff, size_t len) noexcept(true){
+        return fold(partial(buff, len));
+    }
+
+    uint16_t Checksum::update(uint16_t cksum, uint16_t oldWord, uint16_t newWord) noexcept(true){
+        // RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m')
+        uint32_t  sum  = static_cast<uint16_t>(~cksum);
+        sum           += static_cast<uint16_t>(~oldWord);
+        sum           += newWord;
+        return fold(sum);
+    }
+
+    uint16_t Checksum::update(uint16_t cksum, const void* oldBuff, const void* newBuff, size_t len) noexcept(true){
+        // Same as above for an even-aligned run of words: ~m is folded in as 
+        // the complement of the old run's partial sum.
+        uint32_t  sum  = static_cast<uint16_t>(~cksum);
+        sum           += static_cast<uint16_t>(~partial(oldBuff, len));
+        sum           += partial(newBuff, len);
+        return fold(sum);
+    }
+
+    FastRng::FastRng(uint64_t seed) : s0(), s1(), s2(), s3(), out(), used{RNDLANES}
+    {
+        // SplitMix64 expands the seed, so that close seeds still give unrelated lanes.
+        auto  split  = [&seed]() -> uint64_t { return mix(seed += 0x9E3779B97F4A7C15ULL); };
+        for(size_t l = 0; l < RNDLANES; ++l){
+            s0[l]    = split();
+            s1[l]    = split();
+            s2[l]    = split();
+            s3[l]    = split();
+        }
+    }
+
+    void FastRng::step(uint64_t* dst) noexcept(true){
+        // Independent xoshiro256** lanes in separate arrays: the loop has no 
+        // dependency between iterations and the compiler turns it into vector code.
+        for(size_t l = 0; l < RNDLANES; ++l){
+            uint64_t  r  = s1[l] * 5;
+            dst[l]       = ((r << 7) | (r >> 57)) * 9;
+            uint64_t  t  = s1[l] << 17;
+            s2[l]       ^= s0[l];
+            s3[l]       ^= s1[l];
+            s1[l]       ^= s2[l];
+            s0[l]       ^= s3[l];
+            s2[l]       ^= t;
+            s3[l]        = (s3[l] << 45) | (s3[l] >> 19);
+        }
+    }
+
+    uint64_t FastRng::mix(uint64_t val) noexcept(true){
+        val          = (val ^ (val >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        val          = (val ^ (val >> 27)) * 0x94D049BB133111EBULL;
+        return val ^ (val >> 31);
+    }
+
+    uint64_t FastRng::next(void) noexcept(true){
+        if(used == RNDLANES){
+            step(out.data());
+            used     = 0;
+        }
+        return out[used++];
+    }
+
+    void FastRng::fill(uint8_t* buff, size_t len) noexcept(true){
+        const size_t  block  = sizeof(uint64_t) * RNDLANES;
+        uint64_t      words[RNDLANES];
+        for(; len >= block; buff += block, len -= block){
+            step(words);
+            memcpy(buff, words, block);
+        }
+        for(; len > 0; buff += min(len, sizeof(uint64_t)), len -= min(len, sizeof(uint64_t))){
+            uint64_t  w    = next();
+            memcpy(buff, &w, min(len, sizeof(w)));
+        }
+    }
+
+    FastRng& FastRng::local(void) noexcept(false){
+        // One generator per thread, seeded once: random_device is only read 
+        // when a thread first needs random bytes.
+        thread_local FastRng  rng([](){
+                                      random_device  rdev;
+                                      return (static_cast<uint64_t>(rdev()) << 32 | rdev()) ^
+                                             static_cast<uint64_t>(chrono::steady_clock::now().time_since_epoch().count());
+                                  }());
+        return rng;
+    }
+
+    PayloadPool::PayloadPool(void) : data(RNDPOOLSIZE + UINT16_MAX + 1), prefix(data.size() / 2 + 1)
+    {
+        FastRng::local().fill(data.data(), data.size());
+        prefix[0]      = 0;
+        for(size_t i = 0; i < data.size() / 2; ++i){
+            uint16_t  word;
+            memcpy(&word, &data[i * 2], sizeof(word));
+            prefix[i + 1]  = prefix[i] + word;
+        }
+    }
+
+    const PayloadPool& PayloadPool::get(void) noexcept(false){
+        static const PayloadPool  pool;
+        return pool;
+    }
+
+    const uint8_t* PayloadPool::pick(size_t len, uint32_t& sum) const noexcept(false){
+        // Segments start on a word boundary, so the running word sums give 
+        // the partial checksum of any of them without reading the bytes.
+        size_t    word  = FastRng::local().next() % (RNDPOOLSIZE / 2),
+                  off   = word * 2;
+        uint64_t  total = prefix[word + len / 2] - prefix[word];
+        if(len & 1){
+            uint16_t  last  = 0;
+            *(reinterpret_cast<uint8_t*>(&last)) = data[off + len - 1];
+            total          += last;
+        }
+        while(total >> 16)
+            total           = (total & 0xFFFF) + (total >> 16);
+        sum             = static_cast<uint32_t>(total);
+        return &data[off];
+    }
+
+    JobStat::JobStat(void) : sent{0}, calls{0}, slots{0}, bytes{0},
+                             start{chrono::steady_clock::now().time_since_epoch().count()}, queue{-1},
+                             target{0.0}, targetUnit{PPS}, missed{0}, horizon{0}, replies{0},
+                             cpu{-1}, node{-1}, pairsDone{0}, pairsTotal{0}, 
+                             pairsHot{0}, launchNs{-1}
+    {
+        for(auto& i : kindSent)    i = 0;
+        for(auto& i : kindBytes)   i = 0;
+        for(auto& i : errors)      i = 0;
+        for(auto& i : replyTypes)  i = 0;
+    }
+
+    void JobStat::failed(int err) noexcept(true){
+        // The last slot collects the errno values past the table.
+        errors[err > 0 && err < ERRSLOTS ? err : ERRSLOTS - 1].fetch_add(1, memory_order_relaxed);
+    }
+
+    double JobStat::pps(void) const noexcept(true){
+        int64_t   now   = chrono::steady_clock::now().time_since_epoch().count();
+        double    secs  = static_cast<double>(now - start.load()) * chrono::steady_clock::period::num / 
+                          chrono::steady_clock::period::den;
+        return secs > 0 ? static_cast<double>(sent.load()) / secs : 0.0;
+    }
+
+    double JobStat::bps(void) const noexcept(true){
+        int64_t   now   = chrono::steady_clock::now().time_since_epoch().count();
+        double    secs  = static_cast<double>(now - start.load()) * chrono::steady_clock::period::num / 
+                          chrono::steady_clock::period::den;
+        return secs > 0 ? static_cast<double>(bytes.load()) * 8.0 / secs : 0.0;
+    }
+
+    double JobStat::rate(void) const noexcept(true){
+        return targetUnit.load() == BPS ? bps() : pps();
+    }
+
+    LatencyHist::LatencyHist(void) : total{0}, maxNs{0}
+    {
+        for(auto& i : counts) i = 0;
+    }
+
+    size_t LatencyHist::index(uint64_t ns) noexcept(true){
+        // Exact below 2^HISTSUBBITS ns, then 2^(HISTSUBBITS-1) buckets per 
+        // power of two: about 1.5% of relative error at any scale.
+        const uint64_t  half   = 1ULL << (HISTSUBBITS - 1);
+        if(ns < 2 * half)
+            return static_cast<size_t>(ns);
+
+        int             msb    = 63 - __builtin_clzll(ns);
+        if(msb > HISTMAXMSB)
+            return HISTBUCKETS - 1;
+        int             shift  = msb - (HISTSUBBITS - 1);
+        return static_cast<size_t>((shift + 1) * half + (ns >> shift) - half);
+    }
+
+    uint64_t LatencyHist::highest(size_t idx) noexcept(true){
+        const uint64_t  half   = 1ULL << (HISTSUBBITS - 1);
+        if(idx < 2 * half)
+            return idx;
+        uint64_t        shift  = idx / half - 1,
+                        sub    = idx % half + half;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void LatencyHist::record(uint64_t ns) noexcept(true){
+        counts[index(ns)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        uint64_t  curr  = maxNs.load(memory_order_relaxed);
+        while(ns > curr && !maxNs.compare_exchange_weak(curr, ns, memory_order_relaxed))
+            ;
+    }
+
+    uint64_t LatencyHist::percentile(double pct) const noexcept(true){
+        uint64_t  cnt     = total.load(memory_order_relaxed),
+                  target  = static_cast<uint64_t>(ceil(pct / 100.0 * static_cast<double>(cnt))),
+                  seen    = 0;
+        if(cnt == 0)
+            return 0;
+        for(size_t i = 0; i < HISTBUCKETS; ++i){
+            seen         += counts[i].load(memory_order_relaxed);
+            if(seen >= max<uint64_t>(target, 1))
+                return min(highest(i), maxNs.load(memory_order_relaxed));
+        }
+        return maxNs.load(memory_order_relaxed);
+    }
+
+    uint64_t LatencyHist::getMax(void) const noexcept(true){
+        return maxNs.load(memory_order_relaxed);
+    }
+
+    uint64_t LatencyHist::getCount(void) const noexcept(true){
+        return total.load(memory_order_relaxed);
+    }
+
+    string LatencyHist::durStr(uint64_t ns) noexcept(false){
+        ostringstream  out;
+        out << fixed << setprecision(1);
+        if(ns < 1000ULL)               out << ns << "ns";
+        else if(ns < 1000000ULL)       out << static_cast<double>(ns) / 1e3 << "us";
+        else if(ns < 1000000000ULL)    out << static_cast<double>(ns) / 1e6 << "ms";
+        else                           out << static_cast<double>(ns) / 1e9 << "s";
+        return out.str();
+    }
+
+    Probe::Probe(unsigned long job, double rate) : ident{static_cast<uint16_t>(PROBEIDBASE | (job & 0x0FFF))},
+                                                   interval{static_cast<int64_t>(1e9 / rate)}, next{0}, seq{0},
+                                                   sent{0}, received{0}, reordered{0}, highest{-1}, latest{0},
+                                                   packet()
+    {}
+
+    uint16_t Probe::getIdent(void) const noexcept(true){
+        return ident;
+    }
+
+    int64_t Probe::lastRtt(void) const noexcept(true){
+        return latest.load(memory_order_relaxed);
+    }
+
+    void Probe::poll(int fd, const Ip& tmpl, const Sockaddr_in& sin) noexcept(true){
+        int64_t  now       = chrono::duration_cast<chrono::nanoseconds>(
+                                 chrono::steady_clock::now().time_since_epoch()).count();
+        if(now < next)
+            return;
+        // After a stall the stream resumes at its rate, without a burst.
+        next               = max(next, now - interval) + interval;
+
+        // A well formed echo request, whatever the job does to its own headers.
+        uint32_t  curr     = seq++;
+        uint32_t  magic    = htonl(PROBEMAGIC),
+                  nseq     = htonl(curr);
+        Ip        *ip      = reinterpret_cast<Ip*>(packet.data());
+        Icmp      *icmp    = reinterpret_cast<Icmp*>(packet.data() + sizeof(Ip));
+        uint8_t   *data    = packet.data() + sizeof(Ip) + ICMP_MINLEN;
+        packet.fill(0);
+        ip->ip_v           = IPVERSION;
+        ip->ip_hl          = DEFHDRLEN;
+        ip->ip_ttl         = PROBETTL;
+        ip->ip_p           = IPPROTO_ICMP;
+        ip->ip_len         = static_cast<uint16_t>(packet.size());
+        ip->ip_src         = tmpl.ip_src;
+        ip->ip_dst         = tmpl.ip_dst;
+        icmp->icmp_type    = ICMP_ECHO;
+        icmp->icmp_id      = htons(ident);
+        icmp->icmp_seq     = htons(static_cast<uint16_t>(curr));
+        memcpy(data, &magic, sizeof(magic));
+        memcpy(data + sizeof(magic), &nseq, sizeof(nseq));
+        memcpy(data + 2 * sizeof(uint32_t), &now, sizeof(now));
+        icmp->icmp_cksum   = Checksum::compute(icmp, packet.size() - sizeof(Ip));
+
+        if(sendto(fd, packet.data(), packet.size(), 0, reinterpret_cast<const sockaddr*>(&sin), 
+                  sizeof(Sockaddr_in)) != -1)
+            sent++;
+    }
+
+    bool Probe::reply(const Icmp* icmp, size_t len) noexcept(true){
+        const uint8_t  *data  = reinterpret_cast<const uint8_t*>(icmp) + ICMP_MINLEN;
+        uint32_t       magic,
+                       nseq;
+        int64_t        stamp;
+        if(len < ICMP_MINLEN + 2 * sizeof(uint32_t) + sizeof(int64_t) || icmp->icmp_type != ICMP_ECHOREPLY ||
+           ntohs(icmp->icmp_id) != ident)
+            return false;
+        memcpy(&magic, data, sizeof(magic));
+        memcpy(&nseq,  data + sizeof(magic), sizeof(nseq));
+        memcpy(&stamp, data + 2 * sizeof(uint32_t), sizeof(stamp));
+        if(ntohl(magic) != PROBEMAGIC)
+            return false;
+
+        int64_t  now       = chrono::duration_cast<chrono::nanoseconds>(
+                                 chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t  curr      = ntohl(nseq);
+        rtt.record(now > stamp ? static_cast<uint64_t>(now - stamp) : 0);
+        latest             = now > stamp ? now - stamp : 0;
+        received++;
+        if(curr < highest.load())
+            reordered++;
+        else
+            highest        = curr;
+        return true;
+    }
+
+    uint64_t Probe::lost(bool final) const noexcept(true){
+        // While running only the gaps behind the newest reply count: later
+        // probes may still be in flight.
+        uint64_t  expected = final ? sent.load() : static_cast<uint64_t>(highest.load() + 1);
+        uint64_t  got      = received.load();
+        return expected > got ? expected - got : 0;
+    }
+
+    string Probe::summary(bool final) const noexcept(false){
+        ostringstream  out;
+        uint64_t       snt   = final ? sent.load() : static_cast<uint64_t>(highest.load() + 1),
+                       lst   = lost(final);
+        out << "probe sent: " << sent.load() << " received: " << received.load() << " lost: " << lst
+            << fixed << setprecision(2) << " (" << (snt > 0 ? lst * 100.0 / snt : 0.0) << "%)"
+            << " reordered: " << reordered.load();
+        if(rtt.getCount() > 0)
+            out << " rtt p50: "    << LatencyHist::durStr(rtt.percentile(50.0)) 
+                << " p99: "        << LatencyHist::durStr(rtt.percentile(99.0))
+                << " p99.9: "      << LatencyHist::durStr(rtt.percentile(99.9)) 
+                << " max: "        << LatencyHist::durStr(rtt.getMax());
+        return out.str();
+    }
+
+    JobCtl::JobCtl(void) : state{SLOTFREE}, id{0}, run{false}, live{0}, deadline{0}
+    {}
+
+    bool JobCtl::running(void) const noexcept(true){
+        return run.load(memory_order_relaxed);
+    }
+
+    void JobCtl::setDescr(const string& dsc) noexcept(false){
+        lock_guard<mutex>  lock(coldMtx);
+        descr              = dsc;
+    }
+
+    JobCtl* JobRegistry::acquire(unsigned long id, JobStatPtr stat, const string& descr, int workers) noexcept(false){
+        for(auto& i : slots){
+            int  expected  = SLOTFREE;
+            if(!i.state.compare_exchange_strong(expected, SLOTBUSY))
+                continue;
+            {
+                lock_guard<mutex>  lock(i.coldMtx);
+                i.descr    = descr;
+                i.stat     = stat;
+            }
+            i.id.store(id);
+            i.live.store(workers);
+            i.deadline.store(0);
+            i.run.store(true);
+            i.state.store(SLOTLIVE);
+            return &i;
+        }
+        throw WhException("JobRegistry: too many jobs, the limit is " + to_string(MAXJOBS) + ".");
+    }
+
+    void JobRegistry::release(JobCtl* ctl) noexcept(true){
+        ctl->run.store(false);
+        ctl->state.store(SLOTBUSY);
+        {
+            lock_guard<mutex>  lock(ctl->coldMtx);
+            ctl->descr.clear();
+            ctl->stat.reset();
+        }
+        {
+            lock_guard<mutex>  lock(idleMtx);
+            ctl->state.store(SLOTFREE);
+        }
+        idleCv.notify_all();
+    }
+
+    bool JobRegistry::stop(unsigned long id) noexcept(true){
+        for(auto& i : slots)
+            if(i.state.load() == SLOTLIVE && i.id.load() == id && i.running()){
+                i.run.store(false, memory_order_relaxed);
+                return true;
+            }
+        return false;
+    }
+
+    void JobRegistry::stopAll(void) noexcept(true){
+        for(auto& i : slots)
+            i.run.store(false, memory_order_relaxed);
+    }
+
+    size_t JobRegistry::size(void) const noexcept(true){
+        size_t  count  = 0;
+        for(const auto& i : slots)
+            if(i.state.load() == SLOTLIVE) 
+                count++;
+        return count;
+    }
+
+    void JobRegistry::waitIdle(size_t keep) const noexcept(false){
+        unique_lock<mutex>  lock(idleMtx);
+        idleCv.wait(lock, [&](){ return size() <= keep; });
+    }
+
+    TimerService::TimerService(void) : 
+                                       #ifdef LINUX_OS
+                                           timerFd{-1}, wakeFd{-1}, pollFd{-1},
+                                       #endif
+                                       nextToken{1}, stopping{false}
+    {
+        #ifdef LINUX_OS
+            timerFd          = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            wakeFd           = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            pollFd           = epoll_create1(EPOLL_CLOEXEC);
+            struct epoll_event  ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events        = EPOLLIN;
+            ev.data.fd       = timerFd;
+            bool  ok         = timerFd != -1 && wakeFd != -1 && pollFd != -1 &&
+                               epoll_ctl(pollFd, EPOLL_CTL_ADD, timerFd, &ev) == 0;
+            ev.data.fd       = wakeFd;
+            if(!ok || epoll_ctl(pollFd, EPOLL_CTL_ADD, wakeFd, &ev) != 0){
+                if(timerFd != -1) close(timerFd);
+                if(wakeFd  != -1) close(wakeFd);
+                if(pollFd  != -1) close(pollFd);
+                throw WhException(string("TimerService: cannot create the timer: ") + strerror(errno));
+            }
+        #endif
+        worker               = thread([this](){ loop(); });
+    }
+
+    TimerService::~TimerService(void){
+        {
+            lock_guard<mutex>  lock(mtx);
+            stopping         = true;
+        }
+        wake();
+        if(worker.joinable())
+            worker.join();
+        #ifdef LINUX_OS
+            close(timerFd);
+            close(wakeFd);
+            close(pollFd);
+        #endif
+    }
+
+    uint64_t TimerService::schedule(int64_t delayNs, function<void(void)> action) noexcept(false){
+        int64_t             when   = chrono::steady_clock::now().time_since_epoch().count() + delayNs;
+        lock_guard<mutex>   lock(mtx);
+        uint64_t            token  = nextToken++;
+        bool                first  = pending.empty() || when < pending.begin()->first;
+        pending.emplace(when, make_tuple(token, move(action)));
+        if(first)
+            arm();
+        return token;
+    }
+
+    bool TimerService::cancel(uint64_t token) noexcept(true){
+        lock_guard<mutex>  lock(mtx);
+        for(auto i = pending.begin(); i != pending.end(); ++i)
+            if(get<TMTOKEN>(i->second) == token){
+                pending.erase(i);
+                return true;
+            }
+        return false;
+    }
+
+    void TimerService::wake(void) noexcept(true){
+        #ifdef LINUX_OS
+            uint64_t  one    = 1;
+            if(write(wakeFd, &one, sizeof(one)) == -1 && errno != EAGAIN) 
+                return;
+        #else
+            wakeCv.notify_one();
+        #endif
+    }
+
+    void TimerService::arm(void) noexcept(true){
+        // Called with mtx held: the kernel timer always tracks the earliest deadline.
+        #ifdef LINUX_OS
+            struct itimerspec  spec;
+            memset(&spec, 0, sizeof(spec));
+            if(!pending.empty()){
+                int64_t  when          = max<int64_t>(pending.begin()->first, 1);
+                spec.it_value.tv_sec   = static_cast<time_t>(when / 1000000000LL);
+                spec.it_value.tv_nsec  = static_cast<long>(when % 1000000000LL);
+            }
+            timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+        #else
+            wakeCv.notify_one();
+        #endif
+    }
+
+    void TimerService::loop(void) noexcept(true){
+        // Deadlines are steady_clock nanoseconds, i.e. CLOCK_MONOTONIC on Linux.
+        vector<function<void(void)>>  due;
+        unique_lock<mutex>            lock(mtx);
+        while(!stopping){
+            #ifdef LINUX_OS
+                lock.unlock();
+                struct epoll_event  evs[2];
+                int                 ready  = epoll_wait(pollFd, evs, 2, -1);
+                for(int i = 0; i < ready; ++i){
+                    uint64_t  cnt;
+                    if(read(evs[i].data.fd, &cnt, sizeof(cnt)) == -1) 
+                        continue;
+                }
+                lock.lock();
+            #else
+                if(pending.empty())
+                    wakeCv.wait(lock);
+                else
+                    wakeCv.wait_until(lock, chrono::steady_clock::time_point(
+                                                chrono::steady_clock::duration(pending.begin()->first)));
+            #endif
+            int64_t  now   = chrono::steady_clock::now().time_since_epoch().count();
+            while(!pending.empty() && pending.begin()->first <= now){
+                due.push_back(move(get<TMACTION>(pending.begin()->second)));
+                pending.erase(pending.begin());
+            }
+            arm();
+
+            // Actions run unlocked, they are free to schedule or cancel.
+            lock.unlock();
+            for(auto& action : due){
+                try{
+                    action();
+                }catch(...){}
+            }
+            due.clear();
+            lock.lock();
+        }
+    }
+
+    SenderPool::SenderPool(size_t base) : idle{0}, stopping{false}
+    {
+        lock_guard<mutex>  lock(mtx);
+        for(size_t i = 0; i < base; ++i)
+            threads.emplace_back(&SenderPool::run, this);
+    }
+
+    SenderPool::~SenderPool(void){
+        {
+            lock_guard<mutex>  lock(mtx);
+            stopping       = true;
+        }
+        cv.notify_all();
+        for(auto& i : threads)
+            if(i.joinable()) i.join();
+    }
+
+    void SenderPool::submit(function<void(void)> task) noexcept(false){
+        {
+            lock_guard<mutex>  lock(mtx);
+            if(stopping)
+                throw WhException("SenderPool: the pool is shutting down.");
+            queue.push_back(move(task));
+            // Jobs hold their thread until they end: grow when nobody is free to take it.
+            if(queue.size() > idle)
+                threads.emplace_back(&SenderPool::run, this);
+        }
+        cv.notify_one();
+    }
+
+    size_t SenderPool::getThreads(void) const noexcept(true){
+        lock_guard<mutex>  lock(mtx);
+        return threads.size();
+    }
+
+    size_t SenderPool::getIdle(void) const noexcept(true){
+        lock_guard<mutex>  lock(mtx);
+        return idle;
+    }
+
+    void SenderPool::run(void) noexcept(true){
+        #ifdef LINUX_OS
+            cpu_set_t           home;
+            CPU_ZERO(&home);
+            bool                saved  = sched_getaffinity(0, sizeof(home), &home) == 0;
+        #endif
+        unique_lock<mutex>      lock(mtx);
+        for(;;){
+            idle++;
+            cv.wait(lock, [this](){ return stopping || !queue.empty(); });
+            idle--;
+            if(queue.empty())
+                break;
+            function<void(void)>  task  = move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+
+            try{
+                task();
+            }catch(...){}
+            // The job's env and buffers go now, not when the thread is reused.
+            // They are not recycled: building them costs about 1us, less than
+            // the socket every job opens, and a reused TxPath would carry state.
+            task                 = nullptr;
+            #ifdef LINUX_OS
+                if(saved) Placement::unpin(home);
+            #endif
+            lock.lock();
+        }
+    }
+
+    vector<jobSnap> JobRegistry::snapshot(void) const noexcept(false){
+        // Stopped jobs are left out: their slot is gone once the workers exit.
+        vector<jobSnap>  snap;
+        for(const auto& i : slots){
+            if(i.state.load() != SLOTLIVE || !i.running()) 
+                continue;
+            lock_guard<mutex>  lock(i.coldMtx);
+            snap.push_back(make_tuple(i.id.load(), i.descr, i.stat));
+        }
+        sort(snap.begin(), snap.end(), [](const jobSnap& a, const jobSnap& b){ 
+                                           return get<SNAPID>(a) < get<SNAPID>(b); });
+        return snap;
+    }
+
+    void JobStat::collect(void) noexcept(true){
+        // Workers own their counters: the job totals are summed on demand
+        // instead of sharing contended atomics across cores.
+        if(workers.empty())
+            return;
+
+        uint64_t  wsent = 0, wcalls = 0, wslots = 0, wbytes = 0, wmissed = 0;
+        int64_t   wlaunch = -1;
+        double    wtarget = 0;
+        for(const auto& i : workers){
+            wlaunch   = max(wlaunch, i->launchNs.load());
+            wtarget  += i->target.load();
+            wsent    += i->sent.load();
+            wcalls   += i->calls.load();
+            wslots   += i->slots.load();
+            wbytes   += i->bytes.load();
+            wmissed  += i->missed.load();
+        }
+        for(size_t k = 0; k < BITSPLD; ++k){
+            uint64_t  ksent = 0, kbytes = 0;
+            for(const auto& i : workers){
+                ksent   += i->kindSent[k].load();
+                kbytes  += i->kindBytes[k].load();
+            }
+            kindSent[k]   = ksent;
+            kindBytes[k]  = kbytes;
+        }
+        for(size_t e = 0; e < ERRSLOTS; ++e){
+            uint64_t  errs  = 0;
+            for(const auto& i : workers)
+                errs    += i->errors[e].load();
+            errors[e]     = errs;
+        }
+        sent      = wsent;
+        calls     = wcalls;
+        slots     = wslots;
+        bytes     = wbytes;
+        missed    = wmissed;
+        launchNs  = wlaunch;
+        if(wtarget > 0)
+            target = wtarget;
+        horizon   = workers.front()->horizon.load();
+    }
+
+    double JobStat::fill(void) const noexcept(true){
+        uint64_t  req   = slots.load();
+        return req == 0 ? 0.0 : (static_cast<double>(sent.load()) * 100.0) / static_cast<double>(req);
+    }
+
+    TokenBucket::TokenBucket(double rate, double cap) : perNs{rate / 1e9}, capacity{cap},
+                                                        tokens{cap}, last{now()}, slack{calibrate()}
+    {}
+
+    int64_t TokenBucket::now(void) noexcept(true){
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int64_t TokenBucket::calibrate(void) noexcept(true){
+        // Worst wake-up overshoot of a short sleep on this host: waits longer
+        // than that are slept, the last stretch is spun on the clock.
+        static const int64_t  measured  = [](){
+                                             int64_t  worst = 0;
+                                             for(int i = 0; i < 8; ++i){
+                                                 int64_t  before = now();
+                                                 this_thread::sleep_for(chrono::microseconds(50));
+                                                 worst  = max<int64_t>(worst, now() - before - 50000);
+                                             }
+                                             return min<int64_t>(max<int64_t>(worst, 20000), 2000000);
+                                         }();
+        return measured;
+    }
+
+    void TokenBucket::refill(void) noexcept(true){
+        int64_t  curr   = now();
+        tokens          = min(capacity, tokens + static_cast<double>(curr - last) * perNs);
+        last            = curr;
+    }
+
+    void TokenBucket::acquire(double cost) noexcept(true){
+        // A request larger than the bucket waits for a full bucket and leaves 
+        // a debt, so batches bigger than the burst still average the rate.
+        double   need   = min(cost, capacity);
+
+        refill();
+        if(tokens < need){
+            int64_t  wait   = static_cast<int64_t>((need - tokens) / perNs),
+                     due    = last + wait;
+            if(wait > slack)
+                this_thread::sleep_for(chrono::nanoseconds(wait - slack));
+            while(now() < due){}
+            refill();
+        }
+        tokens         -= cost;
+    }
+
+    void TokenBucket::setRate(double rate) noexcept(true){
+        // Tokens earned so far keep the old rate, the new one applies from now.
+        refill();
+        perNs           = rate / 1e9;
+    }
+
+    double TokenBucket::parseRate(const string& spec, RATEUNIT& unit) noexcept(false){
+        size_t   pos    = 0;
+        double   value  = stod(spec, &pos);
+        string   sfx    = spec.substr(pos);
+        double   mult   = 1.0;
+
+        if(!sfx.empty()){
+            switch(sfx[0]){
+                case 'k':  mult = 1e3; sfx.erase(0, 1); break;
+                case 'm':  mult = 1e6; sfx.erase(0, 1); break;
+                case 'g':  mult = 1e9; sfx.erase(0, 1); break;
+                default:   break;
+            }
+        }
+
+        if(sfx == "pps")                     unit = PPS;
+        else if(sfx == "bit" || sfx == "bps") unit = BPS;
+        else throw invalid_argument("parseRate: unit must be pps or bit");
+
+        if(!(value > 0))
+            throw invalid_argument("parseRate: rate must be positive");
+        // "inf" parses, and so does a finite value the multiplier overflows.
+        if(!isfinite(value * mult))
+            throw invalid_argument("parseRate: rate must be finite");
+
+        return value * mult;
+    }
+
+    string TokenBucket::rateStr(double rate, RATEUNIT unit) noexcept(false){
+        ostringstream  out;
+        const char     *prefix  = "";
+
+        if(rate >= 1e9)      { rate /= 1e9; prefix = "g"; }
+        else if(rate >= 1e6) { rate /= 1e6; prefix = "m"; }
+        else if(rate >= 1e3) { rate /= 1e3; prefix = "k"; }
+        out << fixed << setprecision(rate < 10 ? 2 : 1) << rate << prefix << (unit == BPS ? "bit" : "pps");
+        return out.str();
+    }
+
+    Scenario::Scenario(const string& file, const string& iface, uint16_t pktSize) : path{file}, unit{PPS}, 
+                                                                                 unitSet{false}
+    {
+        ifstream  in(path);
+        if(!in)
+            throw WhException(string("Scenario: cannot open ") + path);
+
+        // One phase per line: <start> <duration> <profile> <args>, '#' starts a comment.
+        // A whole file is read and checked before any packet leaves.
+        string    text;
+        for(size_t lineNo = 1; getline(in, text); ++lineNo){
+            try{
+                istringstream   line(text.substr(0, text.find('#')));
+                string          start, length, shape, from, to, arg, extra;
+                if(!(line >> start))
+                    continue;
+                if(start == "unit"){
+                    RATEUNIT   given;
+                    if(!(line >> shape) || (line >> extra))
+                        throw invalid_argument("unit pps|bit");
+                    TokenBucket::parseRate("1" + shape, given);
+                    if(unitSet && given != unit)
+                        throw invalid_argument("unit conflicts with a previous rate");
+                    unit      = given;
+                    unitSet   = true;
+                    continue;
+                }
+                if(!(line >> length >> shape >> from))
+                    throw invalid_argument("expected <start> <duration> <profile> <rate>");
+
+                int64_t    begin  = parseOffset(start),
+                           span   = parseOffset(length);
+                double     low    = parseLevel(from, iface),
+                           high   = low,
+                           param  = 0;
+                PROFILE    kind;
+                if(span <= 0)
+                    throw invalid_argument("duration must be positive");
+                if(span > numeric_limits<int64_t>::max() - begin)
+                    throw invalid_argument("phase ends out of range");
+
+                if(shape == "hold"){
+                    kind    = PRHOLD;
+                }else if(shape == "ramp" && (line >> to)){
+                    kind    = PRRAMP;
+                    high    = parseLevel(to, iface);
+                }else if(shape == "step" && (line >> to >> arg)){
+                    kind    = PRSTEP;
+                    high    = parseLevel(to, iface);
+                    param   = static_cast<double>(stoul(arg));
+                    if(param < 1)
+                        throw invalid_argument("step needs one or more steps");
+                }else if(shape == "sawtooth" && (line >> to >> arg)){
+                    kind    = PRSAW;
+                    high    = parseLevel(to, iface);
+                    param   = static_cast<double>(parseOffset(arg));
+                    if(param <= 0)
+                        throw invalid_argument("sawtooth period must be positive");
+                }else{
+                    throw invalid_argument("profile must be hold <rate>, ramp <from> <to>, "
+                                           "step <from> <to> <steps> or sawtooth <from> <to> <period>");
+                }
+                if(line >> extra)
+                    throw invalid_argument("trailing " + extra);
+                if(phases.size() >= SCNMAXPHASES)
+                    throw invalid_argument("too many phases");
+
+                phases.push_back(make_tuple(begin, begin + span, kind, low, high, param));
+            }catch(const exception& ex){
+                throw WhException(string("Scenario: ") + path + ":" + to_string(lineNo) + ": " + ex.what());
+            }
+        }
+
+        if(phases.empty())
+            throw WhException(string("Scenario: no phases in ") + path);
+
+        // The line rate is known only once the unit is, levels were parsed as
+        // bit/s and are converted here for a pps scenario.
+        if(unit == PPS){
+            for(auto& i : phases)
+                for(double* level : { &get<PHFROM>(i), &get<PHTO>(i) })
+                    if(*level < 0)
+                        *level = -*level / ((pktSize + SCNETHOVERHEAD) * 8.0);
+        }else{
+            for(auto& i : phases){
+                get<PHFROM>(i) = fabs(get<PHFROM>(i));
+                get<PHTO>(i)   = fabs(get<PHTO>(i));
+            }
+        }
+
+        sort(phases.begin(), phases.end());
+        for(size_t i = 1; i < phases.size(); ++i)
+            if(get<PHSTART>(phases[i]) < get<PHEND>(phases[i - 1]))
+                throw WhException(string("Scenario: overlapping phases in ") + path);
+    }
+
+    int64_t Scenario::parseOffset(const string& spec) noexcept(false){
+        size_t   pos    = 0;
+        double   value  = stod(spec, &pos);
+        string   sfx    = spec.substr(pos);
+        double   mult   = 1e9;
+
+        if(sfx == "ms")                    mult = 1e6;
+        else if(sfx == "us")               mult = 1e3;
+        else if(!sfx.empty() && sfx != "s") throw invalid_argument("time unit must be s, ms or us: " + spec);
+        if(value < 0)
+            throw invalid_argument("negative time: " + spec);
+        // stod takes "nan", "inf" and exponents: the result must fit in nanoseconds.
+        if(!isfinite(value) || value > static_cast<double>(numeric_limits<int64_t>::max()) / mult)
+            throw invalid_argument("time out of range: " + spec);
+
+        return static_cast<int64_t>(value * mult);
+    }
+
+    double Scenario::parseLevel(const string& spec, const string& iface) noexcept(false){
+        // "line" is the link speed: negative until the unit is settled.
+        if(spec == "line"){
+            ifstream  speed("/sys/class/net/" + iface + "/speed");
+            long      mbits = -1;
+            if(!(speed >> mbits) || mbits <= 0)
+                throw invalid_argument("line rate unknown for " + iface);
+            return -static_cast<double>(mbits) * 1e6;
+        }
+
+        RATEUNIT  given;
+        double    rate   = TokenBucket::parseRate(spec, given);
+        if(unitSet && given != unit)
+            throw invalid_argument("rates mix pps and bit: " + spec);
+        unit             = given;
+        unitSet          = true;
+        return rate;
+    }
+
+    double Scenario::rateAt(int64_t elapsed, size_t& cursor, int64_t& waitNs) const noexcept(true){
+        // The cursor only moves forward: senders query it once per batch.
+        while(cursor < phases.size() && elapsed >= get<PHEND>(phases[cursor]))
+            ++cursor;
+        if(cursor == phases.size())
+            return -1;
+
+        const phaseItem&  ph    = phases[cursor];
+        int64_t           start = get<PHSTART>(ph);
+        double            from  = get<PHFROM>(ph),
+                          to    = get<PHTO>(ph),
+                          at    = static_cast<double>(elapsed - start),
+                          span  = static_cast<double>(get<PHEND>(ph) - start);
+        if(elapsed < start){
+            waitNs  = start - elapsed;
+            return 0;
+        }
+        waitNs      = 0;
+
+        switch(get<PHSHAPE>(ph)){
+            case PRRAMP:
+                return from + (to - from) * at / span;
+            case PRSTEP:{
+                double  steps  = get<PHARG>(ph),
+                        level  = min(floor(at * steps / span), steps - 1);
+                return steps > 1 ? from + (to - from) * level / (steps - 1) : from;
+            }
+            case PRSAW:
+                return from + (to - from) * fmod(at, get<PHARG>(ph)) / get<PHARG>(ph);
+            default:
+                return from;
+        }
+    }
+
+    double Scenario::initial(void) const noexcept(true){
+        return get<PHFROM>(phases.front());
+    }
+
+    RATEUNIT Scenario::getUnit(void) const noexcept(true){
+        return unit;
+    }
+
+    int64_t Scenario::getLength(void) const noexcept(true){
+        return get<PHEND>(phases.back());
+    }
+
+    size_t Scenario::getPhases(void) const noexcept(true){
+        return phases.size();
+    }
+
+    const string& Scenario::getPath(void) const noexcept(true){
+        return path;
+    }
+
+    #ifdef HAVE_TXTIME
+
+    LaunchSched::LaunchSched(double rate, RATEUNIT u, int64_t horizon) : nsPerUnit{1e9 / rate}, nextLaunch{0},
+                                                                         unit{u}, horizonNs{horizon},
+                                                                         missed{0}, ctrl()
+    {}
+
+    int64_t LaunchSched::now(void) noexcept(true){
+        // fq and etf compare launch times against CLOCK_MONOTONIC.
+        struct timespec  ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    void LaunchSched::enable(int fd) noexcept(false){
+        struct sock_txtime  cfg;
+        cfg.clockid        = CLOCK_MONOTONIC;
+        cfg.flags          = SOF_TXTIME_REPORT_ERRORS;
+        if(setsockopt(fd, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) == -1)
+            throw WhException(string("LaunchSched: SO_TXTIME setting error: ") + strerror(errno));
+    }
+
+    void LaunchSched::attach(vector<struct mmsghdr>& msgs) noexcept(false){
+        const size_t  words  = CMSG_SPACE(sizeof(uint64_t)) / sizeof(uint64_t);
+
+        ctrl.assign(msgs.size() * words, 0);
+        for(size_t i = 0; i < msgs.size(); ++i){
+            struct msghdr&   hdr   = msgs[i].msg_hdr;
+            hdr.msg_control        = &ctrl[i * words];
+            hdr.msg_controllen     = CMSG_SPACE(sizeof(uint64_t));
+            struct cmsghdr   *cm   = CMSG_FIRSTHDR(&hdr);
+            cm->cmsg_level         = SOL_SOCKET;
+            cm->cmsg_type          = SCM_TXTIME;
+            cm->cmsg_len           = CMSG_LEN(sizeof(uint64_t));
+        }
+    }
+
+    void LaunchSched::stamp(vector<struct mmsghdr>& msgs, size_t first, size_t cnt) noexcept(true){
+        int64_t  curr      = now();
+        if(nextLaunch == 0)
+            nextLaunch     = static_cast<double>(curr);
+
+        // Stay at most one horizon ahead of the qdisc: the thread sleeps, the
+        // kernel spaces the departures.
+        int64_t  lead      = static_cast<int64_t>(nextLaunch) - curr;
+        if(lead > horizonNs){
+            this_thread::sleep_for(chrono::nanoseconds(lead - horizonNs));
+            curr           = now();
+        }
+
+        // The schedule is kept in fractional nanoseconds: truncating every
+        // step would make any rate that doesn't divide 1e9 run fast.
+        for(size_t i = first; i < first + cnt; ++i){
+            if(nextLaunch < curr){
+                // Already late: it leaves at once, the schedule restarts from now.
+                missed++;
+                nextLaunch = static_cast<double>(curr);
+            }
+            uint64_t  launch  = static_cast<uint64_t>(nextLaunch);
+            memcpy(CMSG_DATA(CMSG_FIRSTHDR(&msgs[i].msg_hdr)), &launch, sizeof(launch));
+            // Random payloads travel as a second iovec: the packet is all of them.
+            size_t    bytes   = 0;
+            for(size_t v = 0; unit == BPS && v < static_cast<size_t>(msgs[i].msg_hdr.msg_iovlen); ++v)
+                bytes        += msgs[i].msg_hdr.msg_iov[v].iov_len;
+            nextLaunch       += unit == BPS ? bytes * 8.0 * nsPerUnit : nsPerUnit;
+        }
+    }
+
+    size_t LaunchSched::drainErrors(int fd) noexcept(true){
+        // Deadline misses detected by the qdisc (etf) come back on the error queue.
+        size_t          count  = 0;
+        uint64_t        cbuf[64];
+        struct msghdr   msg;
+
+        for(;;){
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control      = cbuf;
+            msg.msg_controllen   = sizeof(cbuf);
+            if(recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+                break;
+            for(struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)){
+                if(cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR)
+                    continue;
+                struct sock_extended_err  err;
+                memcpy(&err, CMSG_DATA(cm), sizeof(err));
+                if(err.ee_origin == SO_EE_ORIGIN_TXTIME)
+                    count++;
+            }
+        }
+        missed          += count;
+        return count;
+    }
+
+    int64_t LaunchSched::getHorizon(void) const noexcept(true){
+        return horizonNs;
+    }
+
+    uint64_t LaunchSched::getMissed(void) const noexcept(true){
+        return missed;
+    }
+
+    #endif
+
+    #ifdef LINUX_OS
+
+    RxFilter::Program RxFilter::build(const set<in_addr_t>& peers, const set<int>& types) noexcept(false){
+        enum LABEL { NEXT, TYPES, QUOTED, ACCEPT, DROP };
+
+        if(peers.size() > FLTMAXPEERS || types.size() > FLTMAXTYPES)
+            throw WhException("RxFilter: too many destinations or types for a filter program.");
+
+        const int                      errTypes[] = { ICMP_UNREACH, ICMP_SOURCEQUENCH, ICMP_REDIRECT, 
+                                                      ICMP_TIMXCEED, ICMP_PARAMPROB };
+        Program                        prog;
+        vector<pair<LABEL, LABEL>>     jumps;
+        map<LABEL, size_t>             labels;
+        auto  stmt = [&](uint16_t code, uint32_t k){ 
+                         prog.push_back(BPF_STMT(code, k));
+                         jumps.push_back(make_pair(NEXT, NEXT));
+                     };
+        auto  jeq  = [&](uint32_t k, LABEL jt, LABEL jf){ 
+                         prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, k, 0, 0));
+                         jumps.push_back(make_pair(jt, jf));
+                     };
+        auto  ja   = [&](LABEL to){ 
+                         prog.push_back(BPF_STMT(BPF_JMP | BPF_JA, 0));
+                         jumps.push_back(make_pair(to, NEXT));
+                     };
+
+        // ICMP sent by a target, or an error quoting a datagram sent to it:
+        // intermediate hops report on behalf of the target.
+        stmt(BPF_LD | BPF_B | BPF_ABS, offsetof(struct ip, ip_p));
+        jeq(IPPROTO_ICMP, NEXT, DROP);
+        stmt(BPF_LD | BPF_W | BPF_ABS, offsetof(struct ip, ip_src));
+        for(const auto& i : peers)
+            jeq(ntohl(i), TYPES, NEXT);
+        stmt(BPF_LDX | BPF_B | BPF_MSH, 0);
+        stmt(BPF_LD | BPF_B | BPF_IND, 0);
+        for(const auto& i : errTypes)
+            jeq(static_cast<uint32_t>(i), QUOTED, NEXT);
+        ja(DROP);
+        labels[QUOTED] = prog.size();
+        stmt(BPF_LD | BPF_W | BPF_IND, ICMP_MINLEN + offsetof(struct ip, ip_dst));
+        for(const auto& i : peers)
+            jeq(ntohl(i), ACCEPT, NEXT);
+        ja(DROP);
+        labels[TYPES]  = prog.size();
+        if(!types.empty()){
+            stmt(BPF_LDX | BPF_B | BPF_MSH, 0);
+            stmt(BPF_LD | BPF_B | BPF_IND, 0);
+            for(const auto& i : errTypes)
+                jeq(static_cast<uint32_t>(i), ACCEPT, NEXT);
+            for(const auto& i : types)
+                jeq(static_cast<uint32_t>(i), ACCEPT, NEXT);
+            ja(DROP);
+        }
+        labels[ACCEPT] = prog.size();
+        stmt(BPF_RET | BPF_K, MAXRCVPKTSIZE);
+        labels[DROP]   = prog.size();
+        stmt(BPF_RET | BPF_K, 0);
+
+        for(size_t pc = 0; pc < prog.size(); ++pc){
+            LABEL  jt  = jumps[pc].first,
+                   jf  = jumps[pc].second;
+            if(BPF_OP(prog[pc].code) == BPF_JA && BPF_CLASS(prog[pc].code) == BPF_JMP){
+                prog[pc].k   = static_cast<uint32_t>(labels[jt] - pc - 1);
+                continue;
+            }
+            if(jt != NEXT) prog[pc].jt  = static_cast<uint8_t>(labels[jt] - pc - 1);
+            if(jf != NEXT) prog[pc].jf  = static_cast<uint8_t>(labels[jf] - pc - 1);
+        }
+
+        return prog;
+    }
+
+    RxFilter::Program RxFilter::dropAll(void) noexcept(false){
+        return Program{ BPF_STMT(BPF_RET | BPF_K, 0) };
+    }
+
+    void RxFilter::attach(int fd, Program& prog) noexcept(false){
+        struct sock_fprog  fprog;
+        fprog.len          = static_cast<unsigned short>(prog.size());
+        fprog.filter       = prog.data();
+        if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1)
+            throw WhException(string("RxFilter: SO_ATTACH_FILTER setting error: ") + strerror(errno));
+    }
+
+    uint64_t RxFilter::icmpInMsgs(void) noexcept(true){
+        ifstream      snmp("/proc/net/snmp");
+        string        names,
+                      values;
+
+        while(getline(snmp, names)){
+            if(names.compare(0, 5, "Icmp:") != 0) continue;
+            if(!getline(snmp, values))            break;
+
+            istringstream  nstr(names),
+                           vstr(values);
+            string         name,
+                           value;
+            while(nstr >> name && vstr >> value)
+                if(name == "InMsgs")
+                    return strtoull(value.c_str(), nullptr, 10);
+            break;
+        }
+        return 0;
+    }
+
+    vector<int> Placement::parseList(const string& spec) noexcept(false){
+        vector<int>     cpus;
+        istringstream   in(spec);
+        string          item;
+
+        while(getline(in, item, ',')){
+            size_t         dash  = item.find('-');
+            unsigned long  first = stoul(item.substr(0, dash)),
+                           last  = dash == string::npos ? first : stoul(item.substr(dash + 1));
+            if(last < first || last >= CPU_SETSIZE)
+                throw invalid_argument("parseList: invalid cpu range " + item);
+            for(unsigned long cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(static_cast<int>(cpu));
+        }
+        if(cpus.empty())
+            throw invalid_argument("parseList: empty cpu list");
+        return cpus;
+    }
+
+    vector<int> Placement::onlineCpus(void) noexcept(false){
+        ifstream  online("/sys/devices/system/cpu/online");
+        string    spec;
+        if(!getline(online, spec))
+            throw WhException("Placement: cannot read the online cpu list.");
+        return parseList(spec);
+    }
+
+    vector<int> Placement::nodeCpus(int node) noexcept(false){
+        ifstream  cpulist("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+        string    spec;
+        if(!getline(cpulist, spec) || spec.empty())
+            throw WhException("Placement: cannot read the cpu list of node " + to_string(node) + ".");
+        return parseList(spec);
+    }
+
+    int Placement::ifaceNode(const string& iface) noexcept(true){
+        // Virtual devices have no parent device, single node systems report -1.
+        ifstream  numa("/sys/class/net/" + iface + "/device/numa_node");
+        int       node  = -1;
+        if(!(numa >> node))
+            return -1;
+        return node;
+    }
+
+    void Placement::pin(const vector<int>& cpus) noexcept(false){
+        cpu_set_t  set;
+        CPU_ZERO(&set);
+        for(const auto& i : cpus)
+            CPU_SET(i, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) == -1)
+            throw WhException(string("Placement: sched_setaffinity error: ") + strerror(errno));
+    }
+
+    void Placement::preferNode(int node) noexcept(true){
+        // A preference, not a binding: a full node still falls back elsewhere.
+        if(node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8 - 1))
+            return;
+        unsigned long  mask  = 1UL << node;
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8);
+    }
+
+    void Placement::unpin(const cpu_set_t& home) noexcept(true){
+        // Pooled threads go back to their original cpus and memory policy between jobs.
+        sched_setaffinity(0, sizeof(home), &home);
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+    }
+
     #endif
 
+    RxWorker::RxWorker(Printer prn) : fd{socket(PF_INET, SOCK_RAW, IPPROTO_ICMP)}, running{true}, orphans{0},
+                                      received{0}, icmpBase{0}, printer(prn), 
+                                      pool(RXPOOLSIZE, vector<uint8_t>(MAXRCVPKTSIZE))
+    {
+        if(fd == -1)
+            throw WhException(string("RxWorker: Socket Creation Error: ") + strerror(errno));
+
+        #ifdef LINUX_OS
+            refilter();
+            icmpBase   = RxFilter::icmpInMsgs();
+        #endif
+
+        for(size_t i = 0; i < pool.size(); ++i)
+            freeBufs.push_back(i);
+
+        worker     = thread(&RxWorker::receiveLoop, this);
+        printerTh  = thread(&RxWorker::printLoop,   this);
+    }
+
+    RxWorker::~RxWorker(void){
+        running    = false;
+        poolCv.notify_all();
+        if(worker.joinable())    worker.join();
+        if(printerTh.joinable()) printerTh.join();
+        close(fd);
+    }
+
+    void RxWorker::subscribe(unsigned long id, in_addr_t dst, int type, bool print, JobStatPtr stat) noexcept(false){
+        lock_guard<mutex>  lock(subMtx);
+        subs[id]   = make_tuple(dst, type, print, stat);
+        refilter();
+    }
+
+    void RxWorker::capture(shared_ptr<PcapRing> ring) noexcept(true){
+        lock_guard<mutex>  lock(subMtx);
+        pcap       = ring;
+    }
+
+    void RxWorker::unsubscribe(unsigned long id) noexcept(true){
+        lock_guard<mutex>  lock(subMtx);
+        subs.erase(id);
+        refilter();
+    }
+
+    uint64_t RxWorker::getOrphans(void) const noexcept(true){
+        return orphans.load();
+    }
+
+    uint64_t RxWorker::getFiltered(void) const noexcept(true){
+        #ifdef LINUX_OS
+            uint64_t  seen  = RxFilter::icmpInMsgs() - icmpBase;
+            return seen > received.load() ? seen - received.load() : 0;
+        #else
+            return 0;
+        #endif
+    }
+
+    int RxWorker::replyType(int reqType) noexcept(true){
+        switch(reqType){
+            case ICMP_ECHO:           return ICMP_ECHOREPLY;
+            case ICMP_TSTAMP:         return ICMP_TSTAMPREPLY;
+            case ICMP_IREQ:           return ICMP_IREQREPLY;
+            case ICMP_MASKREQ:        return ICMP_MASKREPLY;
+            case ICMP_ROUTERSOLICIT:  return ICMP_ROUTERADVERT;
+            default:                  return -1;
+        }
+    }
+
+    void RxWorker::refilter(void) noexcept(true){
+        // Called with subMtx held: the program follows the job list.
+        #ifdef LINUX_OS
+            set<in_addr_t>  peers;
+            set<int>        types;
+            bool            anyType  = false;
+            for(const auto& i : subs){
+                peers.insert(get<SUBDST>(i.second));
+                if(get<SUBTYPE>(i.second) == RXANYTYPE)
+                    anyType  = true;
+                else if(replyType(get<SUBTYPE>(i.second)) >= 0)
+                    types.insert(replyType(get<SUBTYPE>(i.second)));
+                if(get<SUBSTATS>(i.second)->probe)
+                    types.insert(ICMP_ECHOREPLY);
+            }
+            // No types means any type: jobs without a reply type only want 
+            // the errors, which every program accepts.
+            if(anyType) 
+                types.clear();
+            else if(types.empty())
+                types.insert(ICMP_UNREACH);
+
+            try{
+                RxFilter::Program  prog  = peers.empty() ? RxFilter::dropAll() : RxFilter::build(peers, types);
+                RxFilter::attach(fd, prog);
+            }catch(...){
+                // Unfiltered: dispatch still attributes, at a higher cost.
+                int  dummy  = 0;
+                setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+            }
+        #endif
+    }
+
+    void RxWorker::release(size_t buf) noexcept(true){
+        lock_guard<mutex>  lock(poolMtx);
+        freeBufs.push_back(buf);
+        poolCv.notify_all();
+    }
+
+    bool RxWorker::dispatch(size_t buf, size_t len) noexcept(true){
+        const vector<uint8_t>&  pkt    = pool[buf];
+        const Ip                *ip    = reinterpret_cast<const Ip*>(pkt.data());
+        size_t                  hl     = len >= sizeof(Ip) ? ip->ip_hl * 4U : 0;
+
+        if(hl < sizeof(Ip) || len < hl + ICMP_MINLEN){
+            orphans++;
+            return false;
+        }
+
+        // Match on the request that caused the packet: replies come from the 
+        // target, errors quote the original datagram.
+        const Icmp              *icmp  = reinterpret_cast<const Icmp*>(pkt.data() + hl);
+        in_addr_t               peer   = ip->ip_src.s_addr;
+        int                     orig   = RXANYTYPE;
+        switch(icmp->icmp_type){
+            case ICMP_UNREACH:  case ICMP_SOURCEQUENCH:  case ICMP_REDIRECT:  
+            case ICMP_TIMXCEED: case ICMP_PARAMPROB:
+                if(len >= hl + ICMP_MINLEN + sizeof(Ip)){
+                    const Ip  *qip  = reinterpret_cast<const Ip*>(pkt.data() + hl + ICMP_MINLEN);
+                    size_t    qhl   = qip->ip_hl * 4U;
+                    peer            = qip->ip_dst.s_addr;
+                    if(len > hl + ICMP_MINLEN + qhl)
+                        orig        = pkt[hl + ICMP_MINLEN + qhl];
+                }
+            break;
+            case ICMP_ECHOREPLY:     orig = ICMP_ECHO;          break;
+            case ICMP_TSTAMPREPLY:   orig = ICMP_TSTAMP;        break;
+            case ICMP_IREQREPLY:     orig = ICMP_IREQ;          break;
+            case ICMP_MASKREPLY:     orig = ICMP_MASKREQ;       break;
+            case ICMP_ROUTERADVERT:  orig = ICMP_ROUTERSOLICIT; break;
+            default:                                            break;
+        }
+
+        unsigned long   id      = 0;
+        const rxSub     *match  = nullptr;
+        {
+            lock_guard<mutex>  lock(subMtx);
+            if(pcap)
+                pcap->push(pkt.data(), len, chrono::duration_cast<chrono::nanoseconds>(
+                                                chrono::system_clock::now().time_since_epoch()).count());
+            if(icmp->icmp_type == ICMP_ECHOREPLY)
+                for(const auto& i : subs){
+                    const JobStatPtr&  stat  = get<SUBSTATS>(i.second);
+                    if(stat->probe && stat->probe->reply(icmp, len - hl))
+                        return false;
+                }
+            for(const auto& i : subs){
+                if(get<SUBDST>(i.second) != peer) continue;
+                if(get<SUBTYPE>(i.second) == orig || get<SUBTYPE>(i.second) == RXANYTYPE){
+                    id      = i.first;
+                    match   = &i.second;
+                    break;
+                }
+                if(match == nullptr){
+                    id      = i.first;
+                    match   = &i.second;
+                }
+            }
+            if(match == nullptr){
+                orphans++;
+                return false;
+            }
+            get<SUBSTATS>(*match)->replies++;
+            get<SUBSTATS>(*match)->replyTypes[icmp->icmp_type].fetch_add(1, memory_order_relaxed);
+            if(get<SUBSTATS>(*match)->matrix)
+                get<SUBSTATS>(*match)->matrix->reply(pkt.data() + hl, len - hl, orig);
+            if(!get<SUBPRINT>(*match))
+                return false;
+        }
+
+        lock_guard<mutex>  lock(poolMtx);
+        printQueue.push_back(make_tuple(id, buf, len));
+        poolCv.notify_all();
+        return true;
+    }
+
+    void RxWorker::receiveLoop(void) noexcept(true){
+        vector<struct mmsghdr>  msgs(RXBATCH);
+        vector<struct iovec>    iovs(RXBATCH);
+        vector<size_t>          bufs;
+        fd_set                  readfd;
+
+        while(running){
+            struct timeval  tmo  = { 0, RXPOLLMS * 1000 };
+            FD_ZERO(&readfd);
+            FD_SET(fd, &readfd);
+            if(select(fd + 1, &readfd, nullptr, nullptr, &tmo) <= 0)
+                continue;
+
+            // Buffers queued for printing come back when printed: with no 
+            // free one the socket buffer absorbs the backlog meanwhile.
+            bufs.clear();
+            {
+                unique_lock<mutex>  lock(poolMtx);
+                poolCv.wait(lock, [&](){ return !freeBufs.empty() || !running; });
+                while(!freeBufs.empty() && bufs.size() < RXBATCH){
+                    bufs.push_back(freeBufs.back());
+                    freeBufs.pop_back();
+                }
+            }
+
+            for(size_t i = 0; i < bufs.size(); ++i){
+                iovs[i].iov_base             = pool[bufs[i]].data();
+                iovs[i].iov_len              = pool[bufs[i]].size();
+                memset(&msgs[i], 0, sizeof(struct mmsghdr));
+                msgs[i].msg_hdr.msg_iov      = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen   = 1;
+            }
+
+            int     recvd  = 0;
+            #ifdef LINUX_OS
+                recvd      = recvmmsg(fd, msgs.data(), static_cast<unsigned int>(bufs.size()), MSG_DONTWAIT, nullptr);
+            #else
+                for(ssize_t res = 0; recvd < static_cast<int>(bufs.size()); ++recvd){
+                    res    = recvmsg(fd, &msgs[recvd].msg_hdr, MSG_DONTWAIT);
+                    if(res == -1) break;
+                    msgs[recvd].msg_len  = static_cast<unsigned int>(res);
+                }
+            #endif
+
+            if(recvd > 0)
+                received  += static_cast<uint64_t>(recvd);
+            for(size_t i = 0; i < bufs.size(); ++i)
+                if(static_cast<int>(i) >= recvd || !dispatch(bufs[i], msgs[i].msg_len))
+                    release(bufs[i]);
+        }
+    }
+
+    void RxWorker::printLoop(void) noexcept(true){
+        for(;;){
+            rxItem  item;
+            {
+                unique_lock<mutex>  lock(poolMtx);
+                poolCv.wait(lock, [&](){ return !printQueue.empty() || !running; });
+                if(printQueue.empty())
+                    return;
+                item      = printQueue.front();
+                printQueue.pop_front();
+            }
+            printer(get<ITEMID>(item), pool[get<ITEMBUF>(item)], get<ITEMLEN>(item));
+            release(get<ITEMBUF>(item));
+        }
+    }
+
+    StatsShm::StatsShm(const string& pth, Source src) : path(pth), fd{-1}, 
+                                                        len{sizeof(StatsHeader) + MAXJOBS * sizeof(StatsRecord)},
+                                                        base{nullptr}, running{true}, source(src)
+    {
+        // wh may run setuid and /dev/shm is world writable: never follow or
+        // reuse a file someone else placed there.
+        fd         = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+        if(fd == -1)
+            throw WhException(string("StatsShm: cannot create ") + path + ": " + strerror(errno));
+
+        void  *mem = MAP_FAILED;
+        if(ftruncate(fd, static_cast<off_t>(len)) == 0)
+            mem    = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(mem == MAP_FAILED){
+            string  err  = strerror(errno);
+            close(fd);
+            unlink(path.c_str());
+            throw WhException(string("StatsShm: cannot map ") + path + ": " + err);
+        }
+
+        // The atomics are constructed in place before anyone touches them.
+        base               = static_cast<uint8_t*>(mem);
+        StatsHeader  *hdr  = new(base) StatsHeader();
+        for(size_t i = 0; i < MAXJOBS; ++i)
+            new(base + sizeof(StatsHeader) + i * sizeof(StatsRecord)) StatsRecord();
+        hdr->magic         = STATSMAGIC;
+        hdr->version       = STATSVERSION;
+        hdr->records       = MAXJOBS;
+        hdr->recordSize    = sizeof(StatsRecord);
+        hdr->pid           = getpid();
+
+        publisher          = thread(&StatsShm::publishLoop, this);
+    }
+
+    StatsShm::~StatsShm(void){
+        running    = false;
+        if(publisher.joinable()) publisher.join();
+        munmap(base, len);
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    const string& StatsShm::getPath(void) const noexcept(true){
+        return path;
+    }
+
+    void StatsShm::publishLoop(void) noexcept(true){
+        while(running){
+            try{
+                publish();
+            }catch(...){
+                // A failed snapshot is retried at the next period.
+            }
+            this_thread::sleep_for(chrono::milliseconds(STATSPUBMS));
+        }
+    }
+
+    void StatsShm::publish(void) noexcept(false){
+        vector<jobSnap>  snap  = source();
+        StatsHeader      *hdr  = reinterpret_cast<StatsHeader*>(base);
+        StatsRecord      *recs = reinterpret_cast<StatsRecord*>(base + sizeof(StatsHeader));
+        int64_t          now   = chrono::steady_clock::now().time_since_epoch().count();
+        uint32_t         cnt   = 0;
+
+        for(const auto& i : snap){
+            const JobStatPtr&  stat  = get<SNAPSTATS>(i);
+            if(!stat || cnt >= MAXJOBS) 
+                continue;
+            stat->collect();
+
+            // Seqlock: odd while the record is being rewritten.
+            StatsRecord&  rec  = recs[cnt++];
+            uint32_t      seq  = rec.seq.load(memory_order_relaxed);
+            rec.seq.store(seq + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            rec.id         = get<SNAPID>(i);
+            rec.sent       = stat->sent.load();
+            rec.bytes      = stat->bytes.load();
+            rec.replies    = stat->replies.load();
+            rec.elapsedNs  = chrono::duration_cast<chrono::nanoseconds>(
+                                 chrono::steady_clock::duration(now - stat->start.load())).count();
+            for(size_t k = 0; k < BITSPLD; ++k){
+                rec.kindSent[k]   = stat->kindSent[k].load();
+                rec.kindBytes[k]  = stat->kindBytes[k].load();
+            }
+            for(size_t e = 0; e < ERRSLOTS; ++e)
+                rec.errors[e]     = stat->errors[e].load();
+            for(size_t t = 0; t < ICMPTYPES; ++t)
+                rec.replyTypes[t] = stat->replyTypes[t].load();
+            rec.seq.store(seq + 2, memory_order_release);
+        }
+
+        hdr->jobs.store(cnt, memory_order_release);
+        hdr->updated.store(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                               chrono::system_clock::now().time_since_epoch()).count()), memory_order_release);
+    }
+
+    LogRing::LogRing(mutex& screen, const char* prm) : slots(new LogRecord[LOGSLOTS]), head{0}, tail{0}, drops{0},
+                                                        running{true}, sleeping{false}, screenMtx(screen), prompt{prm}
+    {
+        for(size_t i = 0; i < LOGSLOTS; ++i)
+            slots[i].seq.store(i, memory_order_relaxed);
+        consumer     = thread(&LogRing::consumeLoop, this);
+    }
+
+    LogRing::~LogRing(void){
+        running      = false;
+        {
+            lock_guard<mutex>  lock(wakeMtx);
+            wakeCv.notify_one();
+        }
+        if(consumer.joinable()) consumer.join();
+    }
+
+    LogRecord* LogRing::claim(size_t& pos) noexcept(true){
+        // Bounded multi-producer queue: a full ring drops the record, senders
+        // never wait for the terminal.
+        pos          = head.load(memory_order_relaxed);
+        while(true){
+            LogRecord&  rec   = slots[pos & (LOGSLOTS - 1)];
+            size_t      seq   = rec.seq.load(memory_order_acquire);
+            ptrdiff_t   diff  = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+            if(diff == 0){
+                if(head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    return &rec;
+            }else if(diff < 0){
+                drops.fetch_add(1, memory_order_relaxed);
+                return nullptr;
+            }else
+                pos   = head.load(memory_order_relaxed);
+        }
+    }
+
+    bool LogRing::text(const string& msg, bool prm) noexcept(true){
+        size_t      pos  = 0;
+        LogRecord   *rec = claim(pos);
+        if(rec == nullptr)
+            return false;
+        rec->kind        = LOGTEXT;
+        rec->prompt      = prm;
+        rec->total       = static_cast<uint32_t>(msg.size());
+        rec->len         = static_cast<uint32_t>(min<size_t>(msg.size(), LOGDATASIZE));
+        rec->header[0]   = '\0';
+        memcpy(rec->data, msg.data(), rec->len);
+        publish(*rec, pos);
+        return true;
+    }
+
+    bool LogRing::dump(const char* header, const uint8_t* buff, size_t len, size_t begin, size_t end) noexcept(true){
+        size_t      pos  = 0;
+        LogRecord   *rec = claim(pos);
+        if(rec == nullptr)
+            return false;
+        rec->kind        = LOGDUMP;
+        rec->prompt      = false;
+        rec->total       = static_cast<uint32_t>(len);
+        rec->len         = static_cast<uint32_t>(min<size_t>(len, LOGDATASIZE));
+        rec->begin       = begin;
+        rec->end         = end;
+        strncpy(rec->header, header, LOGHDRSIZE - 1);
+        rec->header[LOGHDRSIZE - 1] = '\0';
+        memcpy(rec->data, buff, rec->len);
+        publish(*rec, pos);
+        return true;
+    }
+
+    void LogRing::publish(LogRecord& rec, size_t pos) noexcept(true){
+        // The consumer sleeps only on an empty ring: the producer that sees it
+        // asleep after publishing wakes it, the others pay one load.
+        rec.seq.store(pos + 1, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst);
+        if(sleeping.load(memory_order_relaxed)){
+            lock_guard<mutex>  lock(wakeMtx);
+            wakeCv.notify_one();
+        }
+    }
+
+    uint64_t LogRing::getDrops(void) const noexcept(true){
+        return drops.load(memory_order_relaxed);
+    }
+
+    void LogRing::setFile(const string& path) noexcept(false){
+        lock_guard<mutex>  lock(fileMtx);
+        if(file.is_open()) file.close();
+        filePath.clear();
+        if(path.empty())
+            return;
+        file.open(path, ios::out | ios::app);
+        if(!file)
+            throw WhException(string("LogRing: cannot open ") + path + ": " + strerror(errno));
+        filePath         = path;
+    }
+
+    string LogRing::getFile(void) const noexcept(false){
+        lock_guard<mutex>  lock(fileMtx);
+        return filePath;
+    }
+
+    void LogRing::consumeLoop(void) noexcept(true){
+        uint64_t   reported  = 0;
+        while(true){
+            LogRecord&  rec   = slots[tail & (LOGSLOTS - 1)];
+            if(rec.seq.load(memory_order_acquire) == tail + 1){
+                try{
+                    render(rec);
+                }catch(...){
+                    // A record that cannot be printed is skipped.
+                }
+                rec.seq.store(tail + LOGSLOTS, memory_order_release);
+                tail++;
+                continue;
+            }
+            if(!running)
+                break;
+            if(drops.load(memory_order_relaxed) != reported){
+                reported      = drops.load(memory_order_relaxed);
+                lock_guard<mutex>  lock(screenMtx);
+                cerr << "Log ring full, records dropped: " << reported << "\n";
+            }
+
+            // Announce the sleep, then look again: a record published in
+            // between is either seen here or its producer sees the flag.
+            unique_lock<mutex>  lock(wakeMtx);
+            sleeping.store(true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if(rec.seq.load(memory_order_acquire) != tail + 1 && running)
+                wakeCv.wait(lock);
+            sleeping.store(false, memory_order_relaxed);
+        }
+    }
+
+    void LogRing::render(const LogRecord& rec) noexcept(false){
+        if(rec.kind == LOGTEXT){
+            lock_guard<mutex>  lock(screenMtx);
+            cerr.write(reinterpret_cast<const char*>(rec.data), rec.len) << "\n"; 
+            if(rec.prompt) cerr << prompt;
+            return;
+        }
+
+        // Hex dump, formatted here rather than in the loops that produced it.
+        ostringstream  out;
+        size_t         len    = rec.len;
+        bool           last   = false, 
+                       first  = false;
+        out << rec.header << "\n\n";
+        for(size_t i = 0; i < len; i += 16){
+           out << setfill('0') << setw(5) << dec << i << ":  ";
+           for(size_t j = i; j < i + 16; j++){
+              if(rec.end != 0){
+                 if(j == rec.begin){ out << "\033[7m"; first = true; }
+                 if(j == rec.end  ){ out << "\033[0m"; last  = true; }
+              }
+              if(j < len)
+                 out << setfill('0') << setw(2) << hex << static_cast<int>(rec.data[j]) << " ";
+              else out << "   ";
+           }
+           if(first){ out << "\033[0m"; }
+           out << " ";
+           for(size_t j = i; j < i + 16; j++){
+              if(rec.end != 0){
+                 if(last && !first  ){ out << "\033[7m"; last  = false; }
+                 if(j == rec.begin  ){ out << "\033[7m"; first = false; }
+                 if(j == rec.end    ){ out << "\033[0m"; last  = false; }
+              }
+              if(j < len){
+                 if((rec.data[j] > 31) && (rec.data[j] < 128) && (rec.data[j] != 127))
+                    out << rec.data[j];
+                 else out << ".";
+              }
+           }
+           first = false;
+           out << "\n";
+        }
+        if(rec.total > rec.len)
+           out << dec << "(" << rec.total << " bytes, first " << rec.len << " shown)\n";
+        out << "\n\n";
+
+        lock_guard<mutex>  flock(fileMtx);
+        if(file.is_open()){
+            file << out.str();
+            file.flush();
+            return;
+        }
+        lock_guard<mutex>  lock(screenMtx);
+        cerr << out.str();
+    }
+
+    PcapRing::PcapRing(uint32_t snp) : snap{snp}, data(static_cast<size_t>(PCAPSLOTS) * snp), caps(PCAPSLOTS), 
+                                       origs(PCAPSLOTS), stamps(PCAPSLOTS), head{0}, tail{0}, drops{0}, open{true}
+    {}
+
+    void PcapRing::push(const uint8_t* buff, size_t len, int64_t ns) noexcept(true){
+        struct iovec   iov;
+        struct msghdr  msg;
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base   = const_cast<uint8_t*>(buff);
+        iov.iov_len    = len;
+        msg.msg_iov    = &iov;
+        msg.msg_iovlen = 1;
+        push(msg, ns);
+    }
+
+    void PcapRing::push(const struct msghdr& msg, int64_t ns, PCAPFIX fix) noexcept(true){
+        if(!open.load(memory_order_relaxed))
+            return;
+        size_t    h    = head.load(memory_order_relaxed);
+        if(h - tail.load(memory_order_acquire) >= PCAPSLOTS){
+            drops.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        size_t    idx  = h % PCAPSLOTS,
+                  len  = 0;
+        uint32_t  cap  = 0;
+        for(size_t i = 0; i < static_cast<size_t>(msg.msg_iovlen); ++i){
+            size_t  part  = min<size_t>(msg.msg_iov[i].iov_len, snap - cap);
+            memcpy(&data[idx * snap + cap], msg.msg_iov[i].iov_base, part);
+            cap          += static_cast<uint32_t>(part);
+            len          += msg.msg_iov[i].iov_len;
+        }
+        // Frames are built with ip_len in host order and, by default, a zero 
+        // header checksum. buildLinkFrames completes both for the mapped
+        // backends. On a raw socket the kernel does: Linux also recomputes a
+        // checksum set by the user and fills in a zero ip_id, which the copy 
+        // keeps, so captured ids may differ from the wire.
+        // Slots start at any multiple of snap, the header is fixed in a copy.
+        if(fix != PCAPASIS && cap >= sizeof(Ip)){
+            Ip        ip;
+            uint8_t   *slot  = &data[idx * snap];
+            memcpy(&ip, slot, sizeof(ip));
+            ip.ip_len        = htons(static_cast<uint16_t>(len));
+            #ifdef LINUX_OS
+                if(fix == PCAPRAW) ip.ip_sum = DEFCHKSUM;
+            #endif
+            memcpy(slot, &ip, sizeof(ip));
+            if(ip.ip_sum == DEFCHKSUM && ip.ip_hl * 4U <= cap){
+                ip.ip_sum    = Checksum::compute(slot, ip.ip_hl * 4U);
+                memcpy(slot, &ip, sizeof(ip));
+            }
+        }
+        caps[idx]      = cap;
+        origs[idx]     = static_cast<uint32_t>(len);
+        stamps[idx]    = ns;
+        head.store(h + 1, memory_order_release);
+    }
+
+    size_t PcapRing::drain(vector<uint8_t>& out, size_t room) noexcept(false){
+        size_t    t    = tail.load(memory_order_relaxed),
+                  h    = head.load(memory_order_acquire),
+                  cnt  = 0;
+        for(; t != h; ++t, ++cnt){
+            size_t    idx  = t % PCAPSLOTS;
+            if(out.size() + 4 * sizeof(uint32_t) + caps[idx] > room)
+                break;
+            uint32_t  rec[4] = { static_cast<uint32_t>(stamps[idx] / 1000000000), 
+                                 static_cast<uint32_t>(stamps[idx] % 1000000000), caps[idx], origs[idx] };
+            const uint8_t  *r  = reinterpret_cast<const uint8_t*>(rec);
+            out.insert(out.end(), r, r + sizeof(rec));
+            out.insert(out.end(), data.begin() + static_cast<ptrdiff_t>(idx * snap), 
+                       data.begin() + static_cast<ptrdiff_t>(idx * snap + caps[idx]));
+        }
+        tail.store(t, memory_order_release);
+        return cnt;
+    }
+
+    void PcapRing::close(void) noexcept(true){
+        open           = false;
+    }
+
+    uint64_t PcapRing::getDrops(void) const noexcept(true){
+        return drops.load(memory_order_relaxed);
+    }
+
+    PcapWriter::PcapWriter(const string& pth, int dr, uint32_t snp) : path(pth), dir{dr}, fd{-1}, snap{snp},
+                                                                      retired{0}, written{0}, running{true}
+    {
+        fd             = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd == -1)
+            throw WhException(string("PcapWriter: cannot create ") + path + ": " + strerror(errno));
+
+        // Classic pcap, nanosecond timestamps, raw IPv4 frames.
+        uint32_t  hdr[6]  = { PCAPMAGICNS, 2 | 4 << 16, 0, 0, snap, PCAPLINKRAW };
+        if(write(fd, hdr, sizeof(hdr)) != static_cast<ssize_t>(sizeof(hdr))){
+            string  err  = strerror(errno);
+            close(fd);
+            throw WhException(string("PcapWriter: cannot write ") + path + ": " + err);
+        }
+        buff.reserve(PCAPBUFSIZE);
+        writer         = thread(&PcapWriter::writeLoop, this);
+    }
+
+    PcapWriter::~PcapWriter(void){
+        stop();
+    }
+
+    shared_ptr<PcapRing> PcapWriter::attach(int which) noexcept(false){
+        if((dir & which) == 0 || !running)
+            return nullptr;
+        auto               ring  = make_shared<PcapRing>(snap);
+        lock_guard<mutex>  lock(ringsMtx);
+        rings.push_back(ring);
+        return ring;
+    }
+
+    void PcapWriter::stop(void) noexcept(true){
+        if(!writer.joinable())
+            return;
+        running        = false;
+        writer.join();
+        lock_guard<mutex>  lock(ringsMtx);
+        for(auto& r : rings)
+            r->close();
+        close(fd);
+        fd             = -1;
+    }
+
+    const string& PcapWriter::getPath(void) const noexcept(true){
+        return path;
+    }
+
+    int PcapWriter::getDir(void) const noexcept(true){
+        return dir;
+    }
+
+    uint32_t PcapWriter::getSnap(void) const noexcept(true){
+        return snap;
+    }
+
+    uint64_t PcapWriter::getDrops(void) const noexcept(false){
+        lock_guard<mutex>  lock(ringsMtx);
+        uint64_t           total  = retired.load();
+        for(const auto& r : rings)
+            total         += r->getDrops();
+        return total;
+    }
+
+    uint64_t PcapWriter::getWritten(void) const noexcept(true){
+        return written.load();
+    }
+
+    void PcapWriter::flush(void) noexcept(true){
+        size_t  off    = 0;
+        while(off < buff.size()){
+            ssize_t  ret  = write(fd, buff.data() + off, buff.size() - off);
+            if(ret <= 0){
+                if(ret == -1 && errno == EINTR) continue;
+                break;
+            }
+            off          += static_cast<size_t>(ret);
+        }
+        buff.clear();
+    }
+
+    void PcapWriter::writeLoop(void) noexcept(true){
+        auto  last     = chrono::steady_clock::now();
+        bool  stopping = false;
+        while(true){
+            if(!running) stopping = true;
+            size_t  cnt   = 0;
+            try{
+                lock_guard<mutex>  lock(ringsMtx);
+                for(size_t i = 0; i < rings.size(); ++i){
+                    // A full buffer goes out in one write, then draining resumes.
+                    while(true){
+                        cnt     += rings[i]->drain(buff, PCAPBUFSIZE);
+                        if(buff.size() + 4 * sizeof(uint32_t) + snap <= PCAPBUFSIZE)
+                            break;
+                        flush();
+                        last     = chrono::steady_clock::now();
+                    }
+                    // The job is gone and its ring is empty.
+                    if(rings[i].use_count() == 1){
+                        retired += rings[i]->getDrops();
+                        rings.erase(rings.begin() + static_cast<ptrdiff_t>(i--));
+                    }
+                }
+            }catch(...){
+                // Out of memory for the buffer: the packets stay in the rings.
+            }
+            written   += cnt;
+
+            if(stopping || chrono::steady_clock::now() - last >= chrono::milliseconds(PCAPFLUSHMS)){
+                flush();
+                last   = chrono::steady_clock::now();
+            }
+            if(stopping)
+                break;
+            if(cnt == 0)
+                this_thread::sleep_for(chrono::milliseconds(PCAPFLUSHMS / 10));
+        }
+    }
+
+    PcapFile::PcapFile(const string& path) : fd{-1}, base{nullptr}, len{0}, swapped{false}, nanos{false}, l2{0}
+    {
+        fd             = open(path.c_str(), O_RDONLY);
+        if(fd == -1)
+            throw WhException(string("PcapFile: cannot open ") + path + ": " + strerror(errno));
+
+        struct stat  st;
+        void         *mem  = MAP_FAILED;
+        if(fstat(fd, &st) == 0 && st.st_size >= PCAPHDRLEN){
+            len        = static_cast<size_t>(st.st_size);
+            mem        = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        if(mem == MAP_FAILED){
+            close(fd);
+            throw WhException(string("PcapFile: cannot map ") + path);
+        }
+        base           = static_cast<const uint8_t*>(mem);
+        madvise(mem, len, MADV_SEQUENTIAL);
+
+        uint32_t  magic;
+        memcpy(&magic, base, sizeof(magic));
+        switch(magic){
+            case 0xa1b2c3d4:                                  break;
+            case 0xd4c3b2a1:  swapped = true;                 break;
+            case 0xa1b23c4d:  nanos   = true;                 break;
+            case 0x4d3cb2a1:  swapped = true; nanos = true;   break;
+            default:
+                munmap(mem, len);
+                close(fd);
+                throw WhException(string("PcapFile: not a pcap file (pcapng is not supported): ") + path);
+        }
+        switch(word(20)){
+            case 0:                                   l2  = 4;   break;   // BSD loopback
+            case 1:                                   l2  = 14;  break;   // Ethernet
+            case 113:                                 l2  = 16;  break;   // Linux cooked
+            case 12: case 14: case PCAPLINKRAW: case 228:  l2 = 0;   break;
+            default:
+                munmap(mem, len);
+                close(fd);
+                throw WhException(string("PcapFile: unsupported link type in ") + path);
+        }
+    }
+
+    PcapFile::~PcapFile(void){
+        munmap(const_cast<uint8_t*>(base), len);
+        close(fd);
+    }
+
+    size_t PcapFile::getSize(void) const noexcept(true){
+        return len;
+    }
+
+    uint32_t PcapFile::word(size_t off) const noexcept(true){
+        uint32_t  val;
+        memcpy(&val, base + off, sizeof(val));
+        return swapped ? ((val & 0xFF) << 24) | ((val & 0xFF00) << 8) | ((val >> 8) & 0xFF00) | (val >> 24) : val;
+    }
+
+    bool PcapFile::next(size_t& off, const uint8_t*& pkt, uint32_t& plen, int64_t& ns) const noexcept(true){
+        // Only complete IPv4 datagrams can be replayed: the rest is skipped.
+        while(off + PCAPRECLEN <= len){
+            uint32_t  sec   = word(off),
+                      frac  = word(off + 4),
+                      incl  = word(off + 8),
+                      orig  = word(off + 12);
+            size_t    data  = off + PCAPRECLEN;
+            if(data + incl > len)
+                return false;
+            off             = data + incl;
+            if(incl != orig || incl < l2 + sizeof(Ip))
+                continue;
+            const uint8_t  *p  = base + data + l2;
+            if((l2 == 14 || l2 == 16) && (p[-2] != 0x08 || p[-1] != 0x00))
+                continue;
+            if((p[0] >> 4) != IPVERSION)
+                continue;
+            size_t    iplen = static_cast<size_t>(p[2]) << 8 | p[3];
+            plen            = incl - static_cast<uint32_t>(l2);
+            if(iplen >= sizeof(Ip) && iplen < plen)
+                plen        = static_cast<uint32_t>(iplen);
+            pkt             = p;
+            ns              = static_cast<int64_t>(sec) * 1000000000LL + (nanos ? frac : frac * 1000LL);
+            return true;
+        }
+        return false;
+    }
+
+    ScanMatrix::ScanMatrix(const string& pth, size_t lanes) : path(pth), format{SCANCSV}, 
+                                                              live(lanes, nullptr), current(lanes, -1), 
+                                                              done{false}, written{0}
+    {
+        if(path.size() > 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+            format     = SCANJSON;
+        lastCode.fill(-1);
+        if(path.empty())
+            return;
+
+        out.open(path, ios::out | ios::trunc);
+        if(!out)
+            throw WhException(string("ScanMatrix: cannot create ") + path + ": " + strerror(errno));
+        if(format == SCANJSON)
+            out << "[\n";
+        else
+            out << "type,code,variant,length,sent,errors,replies,first_reply_us,reply_codes\n";
+        out.flush();
+
+        writer         = thread(&ScanMatrix::writeLoop, this);
+    }
+
+    ScanMatrix::~ScanMatrix(void){
+        finish();
+    }
+
+    const string& ScanMatrix::getPath(void) const noexcept(true){
+        return path;
+    }
+
+    void ScanMatrix::begin(size_t lane, uint8_t type, uint8_t code, const vector<Frame>& frames, 
+                           const vector<PAYLOAD>& kinds) noexcept(false){
+        int64_t            now   = chrono::steady_clock::now().time_since_epoch().count();
+        uint16_t           key   = static_cast<uint16_t>(type << 8 | code);
+        lock_guard<mutex>  lock(mtx);
+
+        // The row just left keeps collecting replies for a grace period,
+        // unless it is held for another pass.
+        if(current[lane] >= 0 && held.count(static_cast<uint16_t>(current[lane])) == 0)
+            enqueue(static_cast<uint16_t>(current[lane]), now);
+        bool      fresh  = rows.count(key) == 0;
+        ScanRow&  row    = rows[key];
+        for(auto& c : row){
+            if(!fresh) break;
+            c.length     = 0;   c.sent       = 0;   c.errors  = 0;  c.replies  = 0;
+            c.firstSent  = -1;  c.firstReply = -1;  c.replyCodes.clear();
+        }
+        for(size_t i = 0; i < frames.size() && i < kinds.size(); ++i)
+            row[kinds[i]].length = static_cast<uint16_t>(frames[i].size() - sizeof(Ip));
+        lastCode[type]   = code;
+        current[lane]    = key;
+        live[lane]       = &row;
+    }
+
+    void ScanMatrix::sent(size_t lane, const array<uint64_t, BITSPLD>& cnt) noexcept(true){
+        int64_t            now   = chrono::steady_clock::now().time_since_epoch().count();
+        lock_guard<mutex>  lock(mtx);
+        if(live[lane] == nullptr)
+            return;
+        for(size_t k = 0; k < BITSPLD; ++k){
+            if(cnt[k] == 0) continue;
+            ScanCell&  c  = (*live[lane])[k];
+            if(c.firstSent < 0) c.firstSent = now;
+            c.sent       += cnt[k];
+        }
+    }
+
+    void ScanMatrix::enqueue(uint16_t key, int64_t now) noexcept(false){
+        if(out.is_open())
+            pending.push_back(make_pair(key, now + chrono::duration_cast<chrono::steady_clock::duration>(
+                                                       chrono::milliseconds(SCANGRACEMS)).count()));
+    }
+
+    void ScanMatrix::hold(uint16_t key) noexcept(false){
+        lock_guard<mutex>  lock(mtx);
+        held.insert(key);
+    }
+
+    void ScanMatrix::settle(uint16_t key) noexcept(false){
+        int64_t            now   = chrono::steady_clock::now().time_since_epoch().count();
+        lock_guard<mutex>  lock(mtx);
+        if(held.erase(key) == 0)
+            return;
+        // A live row is queued when its lane moves on.
+        if(find(current.cbegin(), current.cend(), key) == current.cend())
+            enqueue(key, now);
+    }
+
+    void ScanMatrix::sample(size_t lane, int64_t rttNs) noexcept(false){
+        lock_guard<mutex>  lock(mtx);
+        if(current[lane] < 0 || rttNs <= 0)
+            return;
+        int64_t&  worst  = targetRtt[static_cast<uint16_t>(current[lane])];
+        worst            = max(worst, rttNs);
+    }
+
+    int64_t ScanMatrix::baseline(void) noexcept(false){
+        lock_guard<mutex>  lock(mtx);
+        vector<int64_t>    all;
+        for(const auto& i : targetRtt)
+            all.push_back(i.second);
+        if(all.empty())
+            return 0;
+        nth_element(all.begin(), all.begin() + static_cast<ptrdiff_t>(all.size() / 2), all.end());
+        return all[all.size() / 2];
+    }
+
+    bool ScanMatrix::reacted(uint16_t key, int64_t base) noexcept(false){
+        lock_guard<mutex>  lock(mtx);
+        auto               row  = rows.find(key);
+        if(row == rows.end())
+            return false;
+        // Any reply counts, rate limited ones included: a partial answer is
+        // still an answer. Quiet pairs count when the target slowed down
+        // while they were sent.
+        for(const auto& c : row->second)
+            if(c.replies > 0)
+                return true;
+        auto               rtt  = targetRtt.find(key);
+        return base > 0 && rtt != targetRtt.end() && rtt->second > base * ADAPTLATFACTOR;
+    }
+
+    void ScanMatrix::failed(size_t lane, PAYLOAD kind) noexcept(true){
+        lock_guard<mutex>  lock(mtx);
+        if(live[lane] != nullptr)
+            (*live[lane])[kind].errors++;
+    }
+
+    void ScanMatrix::reply(const uint8_t* icmp, size_t len, int orig) noexcept(true){
+        int64_t   now    = chrono::steady_clock::now().time_since_epoch().count();
+        int       qcode  = -1;
+        size_t    qlen   = len;
+
+        // Errors quote the request: its code and length pick the cell. 
+        // Other replies go to the latest code sent with the matching type,
+        // which shards only share at their boundaries.
+        switch(icmp[0]){
+            case ICMP_UNREACH:  case ICMP_SOURCEQUENCH:  case ICMP_REDIRECT:  
+            case ICMP_TIMXCEED: case ICMP_PARAMPROB:
+                if(len >= ICMP_MINLEN + sizeof(Ip)){
+                    const Ip  *qip  = reinterpret_cast<const Ip*>(icmp + ICMP_MINLEN);
+                    size_t    qhl   = qip->ip_hl * 4U;
+                    qlen            = ntohs(qip->ip_len) > qhl ? ntohs(qip->ip_len) - qhl : 0;
+                    if(len >= ICMP_MINLEN + qhl + 2)
+                        qcode       = icmp[ICMP_MINLEN + qhl + 1];
+                }
+            break;
+            default:
+            break;
+        }
+        if(orig < 0 || orig > 255)
+            return;
+
+        lock_guard<mutex>  lock(mtx);
+        if(qcode < 0)
+            qcode        = lastCode[orig];
+        if(qcode < 0)
+            return;
+        auto      row    = rows.find(static_cast<uint16_t>(orig << 8 | qcode));
+        if(row == rows.end())
+            return;
+
+        ScanCell  *cell  = nullptr;
+        for(auto& c : row->second){
+            if(c.sent == 0) continue;
+            if(c.length == qlen){
+                cell     = &c;
+                break;
+            }
+            if(cell == nullptr) cell = &c;
+        }
+        if(cell == nullptr)
+            return;
+        cell->replies++;
+        cell->replyCodes[static_cast<uint16_t>(icmp[0] << 8 | icmp[1])]++;
+        if(cell->firstReply < 0)
+            cell->firstReply = now - cell->firstSent;
+    }
+
+    void ScanMatrix::finish(void) noexcept(true){
+        if(!writer.joinable())
+            return;
+        this_thread::sleep_for(chrono::milliseconds(SCANGRACEMS));
+        {
+            lock_guard<mutex>  lock(mtx);
+            for(size_t l = 0; l < current.size(); ++l){
+                if(current[l] >= 0 && held.count(static_cast<uint16_t>(current[l])) == 0)
+                    pending.push_back(make_pair(static_cast<uint16_t>(current[l]), 0));
+                current[l]   = -1;
+                live[l]      = nullptr;
+            }
+            // Rows still held belong to an interrupted adaptive scan.
+            for(const auto& k : held)
+                pending.push_back(make_pair(k, 0));
+            held.clear();
+            done         = true;
+        }
+        cv.notify_all();
+        writer.join();
+        out << (format == SCANJSON ? "\n]\n" : "");
+        out.close();
+    }
+
+    void ScanMatrix::writeLoop(void) noexcept(true){
+        unique_lock<mutex>  lock(mtx);
+        while(true){
+            cv.wait_for(lock, chrono::milliseconds(SCANFLUSHMS), [this](){ return done; });
+
+            // Rows are copied out under the lock, formatted and written without it:
+            // the sender and the receiver never wait on the file.
+            int64_t                            now    = chrono::steady_clock::now().time_since_epoch().count();
+            vector<pair<uint16_t, ScanRow>>    ready;
+            while(!pending.empty() && (done || pending.front().second <= now)){
+                ready.push_back(make_pair(pending.front().first, rows[pending.front().first]));
+                pending.pop_front();
+            }
+            bool                               last   = done && pending.empty();
+
+            if(!ready.empty()){
+                lock.unlock();
+                try{
+                    string  buff;
+                    for(const auto& r : ready)
+                        buff += render(r.first, r.second);
+                    out << buff;
+                    out.flush();
+                }catch(...){
+                    // A row that cannot be formatted is lost, the rest of the scan is not.
+                }
+                lock.lock();
+            }
+            if(last)
+                break;
+        }
+    }
+
+    string ScanMatrix::render(uint16_t key, const ScanRow& row) noexcept(false){
+        const char* const  kindsDescr[BITSPLD] = { "null", "std", "huge", "invlen", "invchks" };
+        stringstream       line;
+
+        line << fixed << setprecision(1);
+        for(size_t k = 0; k < BITSPLD; ++k){
+            const ScanCell&  c    = row[k];
+            if(c.sent == 0 && c.errors == 0)
+                continue;
+            double           lat  = c.firstReply < 0 ? -1.0 : 
+                                    chrono::duration<double, micro>(chrono::steady_clock::duration(c.firstReply)).count();
+            if(format == SCANJSON){
+                line << (written++ > 0 ? ",\n" : "") << "{\"type\":" << (key >> 8) << ",\"code\":" << (key & 0xFF)
+                     << ",\"variant\":\"" << kindsDescr[k] << "\",\"length\":" << c.length 
+                     << ",\"sent\":" << c.sent << ",\"errors\":" << c.errors << ",\"replies\":" << c.replies
+                     << ",\"first_reply_us\":";
+                if(lat < 0) line << "null";
+                else        line << lat;
+                line << ",\"reply_codes\":[";
+                for(auto i = c.replyCodes.cbegin(); i != c.replyCodes.cend(); ++i)
+                    line << (i != c.replyCodes.cbegin() ? "," : "") << "{\"type\":" << (i->first >> 8) 
+                         << ",\"code\":" << (i->first & 0xFF) << ",\"count\":" << i->second << "}";
+                line << "]}";
+            }else{
+                line << (key >> 8) << "," << (key & 0xFF) << "," << kindsDescr[k] << "," << c.length << "," 
+                     << c.sent << "," << c.errors << "," << c.replies << ",";
+                if(lat >= 0) line << lat;
+                line << ",";
+                for(auto i = c.replyCodes.cbegin(); i != c.replyCodes.cend(); ++i)
+                    line << (i != c.replyCodes.cbegin() ? ";" : "") << (i->first >> 8) << "/" 
+                         << (i->first & 0xFF) << ":" << i->second;
+                line << "\n";
+                written++;
+            }
+        }
+        return line.str();
+    }
+
     #ifdef __GNUC__
     #pragma GCC diagnostic push
     #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
     #endif
 
     Env::Env(string& ifc) : debug{false},                iface{ifc},                scanmode{VALIDS},     
-                            maxPktSent{MAXSCANPACKETS},  maxPktSize{MAXSNDPKTSIZE}, thTimeo{0}, 
+                            maxPktSent{MAXSCANPACKETS},  maxPktSize{MAXSNDPKTSIZE}, batch{1},   thTimeo{0}, 
                             ip{nullptr},                 icmp{nullptr},             ifr{},  
-                            payload{0x1F},               printIncoming{false},      params{MAXPARAMS}
+                            payload{0x1F},               rndPayload{false},
+                            printIncoming{false},        backend{RAWSOCK},
+                            qdiscBypass{false},          dstMac{},                  xdpQueue{0},
+                            rate{0},                     rateUnit{PPS},             burst{0},
+                            txTime{false},               txHorizon{TXHORIZONMS},      workers{1},
+                            probeRate{0},                affinity{AFFNONE},           cpuList{},
+                            fuzz{false},                 fuzzSeed{0},                 fuzzFrom{0},
+                            fuzzMode{FZMIXED},           fuzzFields{},                params{MAXPARAMS}
     {}
 
     #ifdef __GNUC__
@@ -95,10 +2860,18 @@ namespace wh{
     #endif
 
     Env::Env(const Env& env) : debug{env.debug},            iface{env.iface},               scanmode{env.scanmode},
-                               maxPktSent{env.maxPktSent},  maxPktSize{env.maxPktSize},     thTimeo{env.thTimeo},
+                               maxPktSent{env.maxPktSent},  maxPktSize{env.maxPktSize},     batch{env.batch},
+                               thTimeo{env.thTimeo},
                                ip{nullptr},                 icmp{nullptr},                  ifr(env.ifr),
-                               payload{env.payload},        printIncoming{env.printIncoming}, 
-                               params{env.params},          packet(env.maxPktSize)
+                               payload{env.payload},        rndPayload{env.rndPayload},
+                               printIncoming{env.printIncoming}, 
+                               backend{env.backend},        qdiscBypass{env.qdiscBypass},   dstMac{env.dstMac},
+                               xdpQueue{env.xdpQueue},      rate{env.rate},                 rateUnit{env.rateUnit},
+                               burst{env.burst},            txTime{env.txTime},             txHorizon{env.txHorizon},
+                               workers{env.workers},        probeRate{env.probeRate},       affinity{env.affinity},         cpuList{env.cpuList},
+                               fuzz{env.fuzz},              fuzzSeed{env.fuzzSeed},         fuzzFrom{env.fuzzFrom},
+                               fuzzMode{env.fuzzMode},      fuzzFields{env.fuzzFields},     scenario{env.scenario},
+                               scanOut{env.scanOut},        pcap{env.pcap},              params{env.params},          packet(env.maxPktSize)
     {
        ip                            = reinterpret_cast<Ip*>(packet.data());
        icmp                          = reinterpret_cast<Icmp*>((packet.data() + sizeof(Ip)));
@@ -138,15 +2911,12 @@ namespace wh{
         
     uint8_t Env::genRnd(vector<uint8_t> *array, ptrdiff_t start) const noexcept(false){
         try{
-            random_device              rdev;         
-            mt19937                    gen(rdev());
-            uniform_int_distribution<> dis(0, 255);
+            FastRng&                   rng = FastRng::local();
             
             if(array == nullptr)
-                return static_cast<uint8_t>(dis(gen));
+                return static_cast<uint8_t>(rng.next());
             else{
-                for(auto i = array->begin() + start; i != array->end(); ++i)
-                    *i = static_cast<uint8_t>(dis(gen));
+                rng.fill(array->data() + start, array->size() - static_cast<size_t>(start));
                 return 0;
             }   
         }catch(...){
@@ -154,19 +2924,295 @@ namespace wh{
         }
     }
 
+    FrameCache::FrameCache(const Env& cenv) : templ(cenv.packet), payload{cenv.payload}, 
+                                              maxSize{cenv.maxPktSize}, tailSums(),
+                                              lastStdSize{0}
+    {
+        Icmp  *icmp         = reinterpret_cast<Icmp*>(templ.data() + sizeof(Ip));
+        icmp->icmp_cksum    = 0;
+    }
+
+    uint32_t FrameCache::tailSum(uint16_t icmpLen) noexcept(true){
+        // Payload words after the icmp header never change for the whole job.
+        auto  cached        = tailSums.find(icmpLen);
+        if(cached != tailSums.end())
+            return cached->second;
+
+        uint32_t  sum       = icmpLen > ICMP_MINLEN ? 
+                              Checksum::partial(templ.data() + sizeof(Ip) + ICMP_MINLEN, icmpLen - ICMP_MINLEN) : 0;
+        tailSums[icmpLen]   = sum;
+        return sum;
+    }
+
+    void FrameCache::materialise(uint8_t type, uint8_t code, uint16_t stdSize,
+                                 vector<Frame>& frames, vector<PAYLOAD>& kinds) noexcept(false){
+        Icmp      *icmp     = reinterpret_cast<Icmp*>(templ.data() + sizeof(Ip));
+        uint16_t  oldWord   = 0,
+                  newWord   = 0;
+        memcpy(&oldWord, icmp, sizeof(oldWord));
+        icmp->icmp_type     = type;
+        icmp->icmp_code     = code;
+        memcpy(&newWord, icmp, sizeof(newWord));
+
+        // Same variants as the previous step: only the type/code word moved,
+        // patch it and its checksum in place instead of rebuilding.
+        if(!frames.empty() && stdSize == lastStdSize){
+            for(auto& fr : frames){
+                if(fr.size() < sizeof(Ip) + ICMP_MINLEN)
+                    continue;
+                Icmp    *ficmp      = reinterpret_cast<Icmp*>(fr.data() + sizeof(Ip));
+                memcpy(ficmp, &newWord, sizeof(newWord));
+                ficmp->icmp_cksum   = Checksum::update(ficmp->icmp_cksum, oldWord, newWord);
+            }
+            return;
+        }
+        lastStdSize         = stdSize;
+
+        auto      chks      = [&](uint16_t len) -> uint16_t {
+                                  uint16_t  icmpLen = static_cast<uint16_t>(len - sizeof(Ip));
+                                  uint32_t  head    = Checksum::partial(icmp, min<uint16_t>(icmpLen, ICMP_MINLEN));
+                                  return Checksum::fold(head + tailSum(icmpLen));
+                              };
+        // Types without a standard payload still get the full ICMP header:
+        // a frame is never shorter than the fields written into it.
+        uint16_t  zeroSize  = sizeof(Ip) + ICMP_MINLEN,
+                  stdLen    = max(stdSize, zeroSize),
+                  minChks   = chks(zeroSize),
+                  stdChks   = stdSize != 0 ? chks(stdSize) : chks(zeroSize),
+                  maxChks   = chks(maxSize);
+
+        auto      addFrame  = [&](PAYLOAD kind, uint16_t len, uint16_t chksum){
+                                  frames.push_back(Frame(templ.begin(), templ.begin() + len));
+                                  Frame&  fr          = frames.back();
+                                  Ip      *fip        = reinterpret_cast<Ip*>(fr.data());
+                                  Icmp    *ficmp      = reinterpret_cast<Icmp*>(fr.data() + sizeof(Ip));
+                                  fip->ip_len         = len;
+                                  ficmp->icmp_cksum   = chksum;
+                                  kinds.push_back(kind);
+                              };
+
+        frames.clear();
+        kinds.clear();
+        if(payload[NOPLD])                    addFrame(NOPLD,      zeroSize, minChks);
+        if(payload[INVCHKSPLD])               addFrame(INVCHKSPLD, zeroSize, stdChks);
+        if(payload[STDPLD] && stdSize != 0)   addFrame(STDPLD,     stdLen,   stdLen == stdSize ? stdChks : minChks);
+        if(payload[MAXPLD])                   addFrame(MAXPLD,     maxSize,  maxChks);
+
+        if(frames.empty())
+            throw WhException("materialise: no payload variant enabled.");
+    }
+
+    Fuzzer::Fuzzer(uint64_t sd, FUZZSTRAT md, const bitset<FZFIELDS>& flds) : seed{sd}, mode{md}, fields()
+    {
+        for(size_t f = 0; f < FZFIELDS; ++f)
+            if(flds[f]) fields.push_back(static_cast<FUZZFIELD>(f));
+        if(fields.empty())
+            throw WhException("Fuzzer: no field to mutate.");
+    }
+
+    uint16_t Fuzzer::read(const Frame& fr, size_t off, size_t width) noexcept(true){
+        return width == 1 ? fr[off] : static_cast<uint16_t>(fr[off] << 8 | fr[off + 1]);
+    }
+
+    void Fuzzer::write(Frame& fr, size_t off, size_t width, uint16_t val) noexcept(true){
+        // The aligned word holding the field moves both checksums by the same
+        // delta, unless the field is one of the checksums. A trailing odd byte
+        // counts as a word padded with zero; a checksum the frame is too short 
+        // to hold is left alone.
+        if(off + width > fr.size())
+            return;
+        size_t    woff     = off & ~static_cast<size_t>(1),
+                  wlen     = min<size_t>(sizeof(uint16_t), fr.size() - woff),
+                  sumOff   = woff < sizeof(Ip) ? FUZZIPSUM : FUZZICMPSUM;
+        uint16_t  oldWord  = 0, 
+                  newWord  = 0,
+                  sum;
+        memcpy(&oldWord, &fr[woff], wlen);
+        if(width == 1){
+            fr[off]        = static_cast<uint8_t>(val);
+        }else{
+            fr[off]        = static_cast<uint8_t>(val >> 8);
+            fr[off + 1]    = static_cast<uint8_t>(val);
+        }
+        if(woff == sumOff || sumOff + sizeof(sum) > fr.size())
+            return;
+        memcpy(&newWord, &fr[woff], wlen);
+        memcpy(&sum, &fr[sumOff], sizeof(sum));
+        sum                = Checksum::update(sum, oldWord, newWord);
+        memcpy(&fr[sumOff], &sum, sizeof(sum));
+    }
+
+    void Fuzzer::mutate(Frame& fr, uint64_t seq, vector<fuzzEdit>& edits) const noexcept(true){
+        static const array<tuple<uint16_t, uint8_t>, FZFIELDS>  
+                   layout{{ make_tuple(0, 1),  make_tuple(1, 1),  make_tuple(2, 2),  make_tuple(4, 2), 
+                            make_tuple(6, 2),  make_tuple(8, 1),  make_tuple(9, 1),  make_tuple(10, 2),
+                            make_tuple(20, 1), make_tuple(21, 1), make_tuple(22, 2), make_tuple(24, 2),
+                            make_tuple(RNDHDRLEN, 1) }};
+        static const array<uint16_t, 6>  bounds{{ 0x0000, 0x0001, 0x7FFF, 0x8000, 0xFFFE, 0xFFFF }};
+
+        // Every packet draws from its own stream: the mutations of packet 
+        // seq only depend on the seed, whatever was sent before it.
+        FastRng   rng(seed ^ FastRng::mix(seq));
+        size_t    cnt      = 1 + rng.next() % FUZZMAXEDITS;
+        for(size_t e = 0; e < cnt; ++e){
+            FUZZFIELD  field   = fields[rng.next() % fields.size()];
+            size_t     off     = get<0>(layout[field]),
+                       width   = get<1>(layout[field]);
+            uint64_t   draw    = rng.next();
+            if(field == FZREST)
+                off           += (draw & 1) * 2;
+            else if(field == FZPAYLOAD){
+                if(fr.size() <= RNDHDRLEN) continue;
+                off           += draw % (fr.size() - RNDHDRLEN);
+            }
+            // Short frames, e.g. types without payload, lack the later fields.
+            if(off + width > fr.size()) continue;
+            uint16_t   mask    = width == 1 ? 0xFF : 0xFFFF,
+                       cur     = read(fr, off, width),
+                       val     = 0;
+            FUZZSTRAT  strat   = mode == FZMIXED ? static_cast<FUZZSTRAT>((draw >> 8) % FZMIXED) : mode;
+            switch(strat){
+                case FZFLIP:
+                    val        = static_cast<uint16_t>(cur ^ (1U << ((draw >> 16) % (width * 8))));
+                break;
+                case FZBOUND:
+                    // Edges of the field range or one step away from the current value.
+                    switch((draw >> 16) % (bounds.size() + 2)){
+                        case 6:   val = static_cast<uint16_t>(cur + 1);             break;
+                        case 7:   val = static_cast<uint16_t>(cur - 1);             break;
+                        default:  val = bounds[(draw >> 16) % (bounds.size() + 2)];  break;
+                    }
+                break;
+                default:
+                    val        = static_cast<uint16_t>(draw >> 32);
+                break;
+            }
+            val               &= mask;
+            edits.push_back(make_tuple(static_cast<uint16_t>(off), static_cast<uint8_t>(width), cur));
+            write(fr, off, width, val);
+        }
+    }
+
+    void Fuzzer::revert(Frame& fr, vector<fuzzEdit>& edits) const noexcept(true){
+        // Newest first: each edit restores the bytes the next one started from.
+        for(auto e = edits.rbegin(); e != edits.rend(); ++e)
+            write(fr, get<EDITOFF>(*e), get<EDITWIDTH>(*e), get<EDITOLD>(*e));
+        edits.clear();
+    }
+
+    TxPath::TxPath(void) : sockFd{-1}, sendFd{-1}, sin(), lane{0}, pool{nullptr}, seq{0}, next{0}, shares{0}, phase{0},
+                           origin{0}
+    {}
+
+    TxPath::~TxPath(void){
+        if(sockFd != -1) close(sockFd);
+    }
+
+    size_t TxPath::bytes(size_t first, size_t cnt) const noexcept(true){
+        size_t  total  = 0;
+        for(size_t i = first; i < first + cnt; ++i)
+            total     += frames[i % frames.size()].size();
+        return total;
+    }
+
+    void TxPath::account(size_t first, size_t cnt, JobStat& stat) const noexcept(true){
+        size_t                     total  = 0;
+        array<uint64_t, BITSPLD>   perKind{};
+        int64_t                    ns     = pcap ? chrono::duration_cast<chrono::nanoseconds>(
+                                                       chrono::system_clock::now().time_since_epoch()).count() : 0;
+        PCAPFIX                    fix    = PCAPRAW;
+        #ifdef LINUX_OS
+            if(ring) fix                  = PCAPLINK;
+            #ifdef HAVE_AFXDP
+                if(xsk) fix               = PCAPLINK;
+            #endif
+        #endif
+        for(size_t i = first; i < first + cnt; ++i){
+            size_t   idx   = i % frames.size(),
+                     len   = frames[idx].size();
+            total         += len;
+            if(pcap) pcap->push(msgs[i].msg_hdr, ns, fix);
+            perKind[kinds[idx]]++;
+            stat.kindSent[kinds[idx]].fetch_add(1, memory_order_relaxed);
+            stat.kindBytes[kinds[idx]].fetch_add(len, memory_order_relaxed);
+        }
+        stat.bytes.fetch_add(total, memory_order_relaxed);
+        if(matrix && cnt > 0)
+            matrix->sent(lane, perKind);
+    }
+
+    void TxPath::mutate(size_t first, size_t cnt) noexcept(true){
+        // Messages left unsent by the previous call keep their sequence 
+        // number and get the same mutations again.
+        for(size_t i = first; i < first + cnt; ++i){
+            fuzz->revert(slots[i], edits[i]);
+            fuzz->mutate(slots[i], seq + (i - first), edits[i]);
+        }
+    }
+
+    void TxPath::randomise(size_t first, size_t cnt) noexcept(false){
+        // The frame keeps the headers: each message gets its own copy of them 
+        // with the checksum of a pool segment, sent as the second iovec.
+        static_assert(RNDHDRLEN == sizeof(Ip) + ICMP_MINLEN, "RNDHDRLEN must cover the ip and icmp headers");
+        for(size_t i = first; i < first + cnt; ++i){
+            Frame&          fr     = frames[i % frames.size()];
+            struct msghdr&  hdr    = msgs[i].msg_hdr;
+            if(fr.size() <= RNDHDRLEN || kinds[i % kinds.size()] == INVCHKSPLD){
+                iovs[2 * i].iov_base   = fr.data();
+                iovs[2 * i].iov_len    = fr.size();
+                hdr.msg_iovlen         = 1;
+                continue;
+            }
+            uint32_t        sum    = 0;
+            size_t          plen   = fr.size() - RNDHDRLEN;
+            uint8_t         *head  = heads[i].data();
+            Icmp            *icmp  = reinterpret_cast<Icmp*>(head + sizeof(Ip));
+            const uint8_t   *pl    = pool->pick(plen, sum);
+            memcpy(head, fr.data(), RNDHDRLEN);
+            icmp->icmp_cksum       = 0;
+            icmp->icmp_cksum       = Checksum::fold(Checksum::partial(icmp, ICMP_MINLEN, sum));
+            iovs[2 * i].iov_base       = head;
+            iovs[2 * i].iov_len        = RNDHDRLEN;
+            iovs[2 * i + 1].iov_base   = const_cast<uint8_t*>(pl);
+            iovs[2 * i + 1].iov_len    = plen;
+            hdr.msg_iovlen         = 2;
+        }
+    }
+
     Wh::Wh(string& iface) : stage{BATCH}, nextThread{0}, prompt{":-X "}, currParam{0}, env(iface),
-                   scanModes{{"all", ALL}, {"alltype", ALLTYPE}, {"allcode", ALLCODE}, {"valids", VALIDS}}, 
-                   scanModesDescr{{ALL, "all"}, {ALLTYPE, "alltype"}, {ALLCODE, "allcode"}, {VALIDS, "valids"}}, 
+                   scanModes{{"all", ALL}, {"alltype", ALLTYPE}, {"allcode", ALLCODE}, {"valids", VALIDS},
+                             {"adaptive", ADAPTIVE}}, 
+                   scanModesDescr{{ALL, "all"}, {ALLTYPE, "alltype"}, {ALLCODE, "allcode"}, {VALIDS, "valids"},
+                                  {ADAPTIVE, "adaptive"}}, 
+                   backends{{"raw", RAWSOCK}, {"packet_mmap", PKTMMAP}, {"afxdp", AFXDP}},
+                   backendsDescr{{RAWSOCK, "raw"}, {PKTMMAP, "packet_mmap"}, {AFXDP, "afxdp"}},
                    opts{{"on", 1}, {"off", 0}},
+                   fuzzModes{{"flip", FZFLIP}, {"bound", FZBOUND}, {"random", FZRANDOM}, {"mixed", FZMIXED}},
+                   fuzzModesDescr{{FZFLIP, "flip"}, {FZBOUND, "bound"}, {FZRANDOM, "random"}, {FZMIXED, "mixed"}},
+                   fuzzFieldSets{{"vhl",   1U << FZVHL},   {"tos",   1U << FZTOS},   {"len",   1U << FZLEN},
+                                 {"id",    1U << FZID},    {"off",   1U << FZOFF},   {"ttl",   1U << FZTTL},
+                                 {"proto", 1U << FZPROTO}, {"sum",   1U << FZSUM},   {"type",  1U << FZTYPE},
+                                 {"code",  1U << FZCODE},  {"icsum", 1U << FZICSUM}, {"rest",  1U << FZREST},
+                                 {"payload", 1U << FZPAYLOAD},
+                                 {"ip",    (1U << FZTYPE) - 1},
+                                 {"icmp",  (1U << FZPAYLOAD) - (1U << FZTYPE)},
+                                 {"all",   (1U << FZFIELDS) - 1}},
                    commands{{ "exit",      [ ](){return 1;}}, 
                             { "wexit",     [&](){if(stage == BATCH) waitExit(); 
                                                  else printPromptErr("waitExit only permitted in batch mode.");
                                                  return 0;}},
-                            { "job",       [&](){if(chkPrno(BNTPAR))  addJobThread();  return 0; }},
-                            { "scan",      [&](){if(chkPrno(SCANPAR)) addScanThread(); return 0; }},
+                            { "job",       [&](){if(chkPrno(BNTPAR, BNTPARMAX) && setJobOpts(BNTPAR))  
+                                                       addJobThread();  return 0; }},
+                            { "fuzz",      [&](){if(chkPrno(BNTPAR, FUZZPARMAX) && setJobOpts(BNTPAR, true))  
+                                                       addJobThread();  return 0; }},
+                            { "scan",      [&](){if(chkPrno(SCANPAR, SCANPARMAX) && setJobOpts(SCANPAR)) 
+                                                       addScanThread(); return 0; }},
+                            { "replay",    [&](){if(chkPrno(REPLAYPAR, REPLAYPARMAX)) 
+                                                       addReplayThread(); return 0; }},
                             { "kill",      [&](){if(chkPrno(KILLPAR)) killThread(); return 0; }},
                             { "help",      [&](){if(chkPrno(NOPAR)) printHelp();  return 0; }}, 
                             { "list",      [&](){if(chkPrno(NOPAR)) printList();  return 0; }},
+                            { "stats",     [&](){statsCmd(); return 0; }},
                             { "reset",     [&](){if(chkPrno(NOPAR)) resetIpHdr(); return 0; }},
                             { "set",       [&](){return parseCommand(ENVCMD); }}
                    },
@@ -223,6 +3269,41 @@ namespace wh{
                             { "maxpktsize", [&](){confMtx.lock(); if(chkPrno(SERPAR)) env.maxPktSize = 
                                                  static_cast<uint16_t>(stoi(env.params[2], nullptr, 0)); 
                                                  confMtx.unlock(); return 0;}},
+                            { "batch",     [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 setBatchSize(env.params[2]);
+                                                 confMtx.unlock(); return 0;}},
+                            { "backend",   [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 setBackend(env.params[2]);
+                                                 confMtx.unlock(); return 0;}},
+                            { "qdiscbypass", [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 setQdiscBypass(env.params[2]);
+                                                 confMtx.unlock(); return 0;}},
+                            { "txtime",    [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 setTxTime(env.params[2]);
+                                                 confMtx.unlock(); return 0;}},
+                            { "txhorizon", [&](){confMtx.lock(); if(chkPrno(SERPAR)) env.txHorizon = 
+                                                 static_cast<uint32_t>(stoul(env.params[2], nullptr, 0)); 
+                                                 confMtx.unlock(); return 0;}},
+                            { "scanout",   [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 env.scanOut = env.params[2] == "off" ? "" : env.params[2];
+                                                 confMtx.unlock(); return 0;}},
+                            { "pcap",      [&](){confMtx.lock(); setPcap(); 
+                                                 confMtx.unlock(); return 0;}},
+                            { "logfile",   [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 setLogFile(env.params[2]);
+                                                 confMtx.unlock(); return 0;}},
+                            { "statsshm",  [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 setStatsShm(env.params[2]);
+                                                 confMtx.unlock(); return 0;}},
+                            { "affinity",  [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 setAffinity(env.params[2]);
+                                                 confMtx.unlock(); return 0;}},
+                            { "xdpqueue",  [&](){confMtx.lock(); if(chkPrno(SERPAR)) env.xdpQueue = 
+                                                 static_cast<uint32_t>(stoul(env.params[2], nullptr, 0)); 
+                                                 confMtx.unlock(); return 0;}},
+                            { "dstmac",    [&](){confMtx.lock(); if(chkPrno(SERPAR)) 
+                                                 env.dstMac = env.params[2] == "auto" ? "" : env.params[2];
+                                                 confMtx.unlock(); return 0;}},
                             { "thrdtimeo", [&](){confMtx.lock(); if(chkPrno(SERPAR)) env.thTimeo    = 
                                                  static_cast<uint32_t>(stoul(env.params[2])); 
                                                  confMtx.unlock(); return 0;}},
@@ -239,7 +3320,9 @@ namespace wh{
                              { "huge",      [&](){confMtx.lock(); if(chkPrno(PLDPAR)) 
                                                   setPayloadMode(env.params[3], MAXPLD); confMtx.unlock(); return 0; }},
                              { "invchks",   [&](){confMtx.lock(); if(chkPrno(PLDPAR)) 
-                                                  setPayloadMode(env.params[3], INVCHKSPLD); confMtx.unlock(); return 0; }}
+                                                  setPayloadMode(env.params[3], INVCHKSPLD); confMtx.unlock(); return 0; }},
+                             { "random",    [&](){confMtx.lock(); if(chkPrno(PLDPAR)) 
+                                                  setRandomPayload(env.params[3]); confMtx.unlock(); return 0; }}
                    },
                    #ifdef LINUX_OS 
                        icmpType{{0,make_tuple(0,0,8)},      {3,make_tuple(0,15,8)},     {4,make_tuple(0,0,8)},
@@ -271,11 +3354,17 @@ namespace wh{
                                 {254,{255,255,0}}, {255,{255,255,0}} 
                        },
                    #endif
-                   icmpTypeFull(icmpType)
+                   icmpTypeFull(icmpType), cpuSlot{0}, monitorGen{0},
+                   log(new LogRing(screenMtx, prompt)),
+                   senders(max<unsigned int>(thread::hardware_concurrency(), 1))
     {
+           stdSizes.fill(0);
            for(uint16_t idx=0; idx<=255; ++idx){
-               if(icmpType.find(static_cast<uint8_t>(idx)) == icmpType.end())
+               auto  known  = icmpType.find(static_cast<uint8_t>(idx));
+               if(known == icmpType.end())
                    icmpTypeFull[static_cast<uint8_t>(idx)]  = make_tuple(0,0,0);
+               else
+                   stdSizes[idx]  = static_cast<uint16_t>(sizeof(Ip) + get<CODEPSIZE>(known->second));
            }
     
            resetIpHdr();
@@ -291,30 +3380,300 @@ namespace wh{
     }
     
     Wh::~Wh(void){
-           for(auto i = threadsList.begin(); i != threadsList.end(); ++i){
-               cerr << "Stopping: " << (*i).first << endl;
-               get<RUN>((*i).second) = false;
-           }
+           for(const auto& i : jobs.snapshot())
+               cerr << "Stopping: " << get<SNAPID>(i) << endl;
+           jobs.stopAll();
+           stopMonitor();
+           shm.reset();
            delete env.ip;
     }
     
     void Wh::printPromptErr(string&& msg, bool prm) const noexcept(true){
           try{
-              screenMtx.lock();
+              // Through the log ring once it runs: callers never wait on the terminal.
+              if(log){
+                  log->text(msg, prm);
+                  return;
+              }
+              lock_guard<mutex>  lock(screenMtx);
               cerr << msg << "\n"; 
               if(prm) cerr << prompt;
-              screenMtx.unlock();
           }catch(...){
-              printPromptErr("printList: unhandled Error");
+              // Nowhere left to report it.
           }
     }
     
+    void Wh::statsCmd(void) noexcept(true){
+        try{
+            if(currParam + 1 > 3){
+                printPromptErr("Invalid number of parameters, expected: stats [id|all|off] [interval]");
+                return;
+            }
+            if(currParam >= 1 && env.params[1] == "off"){
+                stopMonitor();
+                printPromptErr("Stats monitor stopped.");
+                return;
+            }
+
+            bool           all       = currParam < 1 || env.params[1] == "all";
+            unsigned long  id        = all ? 0 : stoul(env.params[1]);
+            unsigned int   interval  = currParam == 2 ? static_cast<unsigned int>(stoul(env.params[2])) : 0;
+            if(interval == 0){
+                printStats(id, all, nullptr, 0);
+                return;
+            }
+
+            // One monitor at a time: a new stats command retires the previous one.
+            stopMonitor();
+            unsigned long  gen       = monitorGen;
+            monitor        = thread([this](unsigned long idcpy, bool allcpy, unsigned int secs, unsigned long mygen){
+                                 try{
+                                     map<unsigned long, pair<uint64_t, uint64_t>>  prev;
+                                     printStats(idcpy, allcpy, &prev, 0);
+                                     unique_lock<mutex>  lock(monitorMtx);
+                                     while(!prev.empty() && 
+                                           !monitorCv.wait_for(lock, chrono::seconds(secs), 
+                                                               [&](){ return monitorGen != mygen; })){
+                                         lock.unlock();
+                                         printStats(idcpy, allcpy, &prev, secs);
+                                         lock.lock();
+                                     }
+                                 }catch(...){
+                                     printPromptErr("Thread of type stats exits for unhandled error.", true);
+                                 }
+                             }, id, all, interval, gen);
+        }catch(...){
+            printPromptErr("Wrong Parameter.");
+        }
+    }
+
+    void Wh::stopMonitor(void) noexcept(true){
+        // Called from the shell thread only: it is the one starting monitors.
+        {
+            lock_guard<mutex>  lock(monitorMtx);
+            monitorGen++;
+        }
+        monitorCv.notify_all();
+        if(monitor.joinable())
+            monitor.join();
+    }
+
+    void Wh::printStats(unsigned long id, bool all, map<unsigned long, pair<uint64_t, uint64_t>>* prev,
+                        unsigned int interval) const noexcept(true){
+          const char* const  kindsDescr[BITSPLD] = { "null", "std", "huge", "invlen", "invchks" };
+          try{
+              vector<jobSnap>  snap  = jobs.snapshot();
+              map<unsigned long, pair<uint64_t, uint64_t>>  curr;
+              screenMtx.lock();
+              for(const auto& i : snap){
+                  const JobStatPtr& stat = get<SNAPSTATS>(i);
+                  if(!stat || (!all && get<SNAPID>(i) != id))
+                      continue;
+                  stat->collect();
+
+                  // Running rates over the last interval, averages since start otherwise.
+                  uint64_t  sent   = stat->sent.load(),
+                            bytes  = stat->bytes.load();
+                  double    pps    = stat->pps(),
+                            bps    = stat->bps();
+                  if(prev != nullptr && interval > 0 && prev->count(get<SNAPID>(i)) > 0){
+                      pps          = static_cast<double>(sent  - (*prev)[get<SNAPID>(i)].first) / interval;
+                      bps          = static_cast<double>(bytes - (*prev)[get<SNAPID>(i)].second) * 8.0 / interval;
+                  }
+                  curr[get<SNAPID>(i)] = make_pair(sent, bytes);
+
+                  cerr << "Job " << get<SNAPID>(i) << " sent: " << sent << " bytes: " << bytes 
+                       << " rate: " << TokenBucket::rateStr(pps, PPS) << " " << TokenBucket::rateStr(bps, BPS)
+                       << " replies: " << stat->replies.load();
+                  if(stat->launchNs.load() >= 0)
+                      cerr << " launch: " << LatencyHist::durStr(static_cast<uint64_t>(stat->launchNs.load()));
+                  if(stat->pairsTotal.load() > 0){
+                      // Formatted aside: cerr keeps its own float format.
+                      ostringstream  pct;
+                      pct << fixed << setprecision(1) << stat->pairsDone.load() * 100.0 / stat->pairsTotal.load();
+                      cerr << " pairs: " << stat->pairsDone.load() << "/" << stat->pairsTotal.load() << " (" 
+                           << pct.str() << "%)";
+                  }
+                  cerr << "\n    payload:";
+                  for(size_t k = 0; k < BITSPLD; ++k)
+                      if(stat->kindSent[k].load() > 0)
+                          cerr << " " << kindsDescr[k] << ": " << stat->kindSent[k].load() << "/" 
+                               << stat->kindBytes[k].load() << "B";
+                  bool  header  = false;
+                  for(size_t e = 0; e < ERRSLOTS; ++e)
+                      if(stat->errors[e].load() > 0){
+                          if(!header) cerr << "\n    send errors:";
+                          header = true;
+                          cerr << " " << (e == ERRSLOTS - 1 ? string("other") : strerror(static_cast<int>(e))) 
+                               << ": " << stat->errors[e].load();
+                      }
+                  if(stat->probe)
+                      cerr << "\n    " << stat->probe->summary(false);
+                  header        = false;
+                  for(size_t t = 0; t < ICMPTYPES; ++t)
+                      if(stat->replyTypes[t].load() > 0){
+                          if(!header) cerr << "\n    replies by type:";
+                          header = true;
+                          cerr << " " << t << ": " << stat->replyTypes[t].load();
+                      }
+                  cerr << endl;
+              }
+              screenMtx.unlock();
+              if(prev != nullptr)
+                  prev->swap(curr);
+          }catch(...){
+              printPromptErr("printStats: unhandled Error");
+          }
+    }
+
+    int Wh::setStatsShm(string& mode) noexcept(true){
+        try{
+            if(mode == "off"){
+                shm.reset();
+                return 0;
+            }
+            #ifdef LINUX_OS
+                string  path  = mode == "on" ? "/dev/shm/wh-stats." + to_string(getpid()) : mode;
+            #else
+                string  path  = mode == "on" ? "/tmp/wh-stats." + to_string(getpid()) : mode;
+            #endif
+            shm.reset();
+            shm.reset(new StatsShm(path, [this](){ return jobs.snapshot(); }));
+            printPromptErr(string("Publishing job counters to ") + path);
+        }catch(const WhException& ex){
+            printPromptErr(ex.what());
+        }catch(...){
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        }
+        return 0;
+    }
+
+    int Wh::setPcap(void) noexcept(true){
+        try{
+            if(currParam + 1 < SERPAR || currParam + 1 > PCAPPARMAX){
+                printPromptErr("Invalid number of parameters, expected: set pcap <file>|off [sent|recv|both] [snaplen]");
+                return 0;
+            }
+            int       dir   = PCAPBOTH;
+            uint32_t  snap  = PCAPSNAPDEF;
+            if(currParam >= 3)
+                dir         = env.params[3] == "sent" ? PCAPSENT : env.params[3] == "recv" ? PCAPRECV :
+                              env.params[3] == "both" ? PCAPBOTH : throw invalid_argument("direction");
+            if(currParam >= 4){
+                unsigned long  val  = stoul(env.params[4]);
+                if(val < sizeof(Ip) || val > MAXSNDPKTSIZE)
+                    throw out_of_range("snaplen");
+                snap        = static_cast<uint32_t>(val);
+            }
+
+            if(env.pcap){
+                env.pcap->stop();
+                env.pcap.reset();
+            }
+            shared_ptr<PcapRing>  ring;
+            if(env.params[2] != "off"){
+                env.pcap.reset(new PcapWriter(env.params[2], dir, snap));
+                ring        = env.pcap->attach(PCAPRECV);
+                printPromptErr(string("Capturing to ") + env.params[2] + " for the jobs started from now.");
+            }
+            lock_guard<mutex>  lock(rxMtx);
+            if(rx)
+                rx->capture(ring);
+        }catch(const WhException& ex){
+            printPromptErr(ex.what());
+        }catch(...){
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        }
+        return 0;
+    }
+
+    int Wh::setLogFile(string& mode) noexcept(true){
+        try{
+            log->setFile(mode == "off" ? "" : mode);
+            if(mode != "off")
+                printPromptErr(string("Writing packet dumps to ") + mode);
+        }catch(const WhException& ex){
+            printPromptErr(ex.what());
+        }catch(...){
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        }
+        return 0;
+    }
+
     void Wh::printList(void) const noexcept(true){
           try{
+              vector<jobSnap>  snap  = jobs.snapshot();
               screenMtx.lock();
               cerr << "Threads:" << endl;
-              for(auto i = threadsList.cbegin(); i != threadsList.cend(); ++i)
-                  cerr << (*i).first << "  " << get<DESCR>((*i).second) << endl;
+              for(const auto& i : snap){
+                  cerr << get<SNAPID>(i) << "  " << get<SNAPDESCR>(i);
+                  const JobStatPtr& stat = get<SNAPSTATS>(i);
+                  if(stat){
+                      stat->collect();
+                      cerr << " sent: " << stat->sent.load() << fixed << setprecision(0);
+                      if(stat->queue.load() >= 0)
+                          cerr << " pps(q" << stat->queue.load() << "): " << stat->pps();
+                      else
+                          cerr << " pps: " << stat->pps();
+                      if(stat->target.load() > 0){
+                          RATEUNIT  unit  = static_cast<RATEUNIT>(stat->targetUnit.load());
+                          cerr << " rate: "  << TokenBucket::rateStr(stat->rate(), unit) 
+                               << "/"        << TokenBucket::rateStr(stat->target.load(), unit)
+                               << " (" << setprecision(1) << stat->rate() * 100.0 / stat->target.load() 
+                               << "%)" << setprecision(0);
+                      }
+                      if(stat->cpu.load() >= 0)
+                          cerr << " cpu: " << stat->cpu.load();
+                      else if(stat->node.load() >= 0)
+                          cerr << " node: " << stat->node.load();
+                      cerr << " replies: " << stat->replies.load();
+                      if(stat->pairsTotal.load() > 0)
+                          cerr << " pairs: " << stat->pairsDone.load() << "/" << stat->pairsTotal.load() << " (" 
+                               << setprecision(1) << stat->pairsDone.load() * 100.0 / stat->pairsTotal.load() 
+                               << "%)" << setprecision(0);
+                      if(stat->horizon.load() > 0)
+                          cerr << " txtime horizon: " << stat->horizon.load() / 1000000 << "ms missed: " 
+                               << stat->missed.load();
+                      if(stat->calls.load() > 0)
+                          cerr << " batchfill: " << setprecision(1) << stat->fill() << "% (" 
+                               << static_cast<double>(stat->sent.load()) / static_cast<double>(stat->calls.load()) 
+                               << " pkts/call)";
+                      for(size_t w = 0; w < stat->workers.size(); ++w){
+                          const JobStatPtr& wstat = stat->workers[w];
+                          cerr << fixed << setprecision(0) << "\n    worker " << w << " sent: " << wstat->sent.load();
+                          if(wstat->queue.load() >= 0)
+                              cerr << " pps(q" << wstat->queue.load() << "): " << wstat->pps();
+                          else
+                              cerr << " pps: " << wstat->pps();
+                          if(wstat->cpu.load() >= 0)
+                              cerr << " cpu: " << wstat->cpu.load();
+                          else if(wstat->node.load() >= 0)
+                              cerr << " node: " << wstat->node.load();
+                          if(wstat->target.load() > 0)
+                              cerr << " rate: " << TokenBucket::rateStr(wstat->rate(), 
+                                                                        static_cast<RATEUNIT>(wstat->targetUnit.load()))
+                                   << "/"       << TokenBucket::rateStr(wstat->target.load(), 
+                                                                        static_cast<RATEUNIT>(wstat->targetUnit.load()));
+                      }
+                      cerr << defaultfloat;
+                  }
+                  cerr << endl;
+              }
+              rxMtx.lock();
+              if(rx){
+                  cerr << "Unattributed replies: " << rx->getOrphans();
+                  #ifdef LINUX_OS
+                      cerr << " filtered in kernel: " << rx->getFiltered();
+                  #endif
+                  cerr << endl;
+              }
+              rxMtx.unlock();
+              if(log && log->getDrops() > 0)
+                  cerr << "Log records dropped: " << log->getDrops() << endl;
+              cerr << "Sender pool: " << senders.getThreads() << " threads, " << senders.getIdle() << " idle" << endl;
+              if(env.pcap)
+                  cerr << "Capture " << env.pcap->getPath() << " packets: " << env.pcap->getWritten() 
+                       << " dropped: " << env.pcap->getDrops() << endl;
               cerr << endl;
               screenMtx.unlock();
           }catch(...){
@@ -330,94 +3689,130 @@ namespace wh{
         }
         return true; 
     }
+
+    bool Wh::chkPrno(PARAMS num, PARAMS max) const noexcept(true){
+        // Mandatory parameters followed by optional <keyword> <value> pairs.
+        if((currParam + 1) < num || (currParam + 1) > max || (currParam + 1 - num) % 2 != 0){
+            printPromptErr(string("Invalid number of parameters, expected ") +
+                           to_string(num) + " plus <option> <value> pairs, specified " +  to_string(currParam + 1));
+            return false;
+        }
+        return true; 
+    }
+
+    bool Wh::setJobOpts(PARAMS first, bool fuzz) noexcept(true){
+        env.rate       = 0;
+        env.rateUnit   = PPS;
+        env.burst      = 0;
+        env.workers    = 1;
+        env.probeRate  = 0;
+        env.fuzz       = fuzz;
+        env.fuzzFrom   = 0;
+        env.fuzzMode   = FZMIXED;
+        env.fuzzFields = fuzzFieldSets.at("all");
+        env.scenario.reset();
+        try{
+            env.fuzzSeed   = fuzz ? FastRng::local().next() : 0;
+        }catch(...){
+            printPromptErr("Error generating the fuzz seed.");
+            return false;
+        }
+        for(size_t i = first; i + 1 < currParam + 1U; i += 2){
+            try{
+                if(fuzz && env.params[i] == "seed")
+                    env.fuzzSeed   = stoull(env.params[i + 1], nullptr, 0);
+                else if(fuzz && env.params[i] == "from")
+                    env.fuzzFrom   = stoull(env.params[i + 1], nullptr, 0);
+                else if(fuzz && env.params[i] == "mutate")
+                    env.fuzzMode   = fuzzModes.at(env.params[i + 1]);
+                else if(fuzz && env.params[i] == "fields"){
+                    istringstream  names(env.params[i + 1]);
+                    string         name;
+                    env.fuzzFields.reset();
+                    while(getline(names, name, ','))
+                        env.fuzzFields |= fuzzFieldSets.at(name);
+                }else if(env.params[i] == "rate")
+                    env.rate   = TokenBucket::parseRate(env.params[i + 1], env.rateUnit);
+                else if(env.params[i] == "burst")
+                    env.burst  = static_cast<uint32_t>(stoul(env.params[i + 1]));
+                else if(env.params[i] == "workers"){
+                    unsigned long  val  = stoul(env.params[i + 1]);
+                    if(val < 1 || val > MAXWORKERS)
+                        throw out_of_range("workers");
+                    env.workers  = static_cast<uint16_t>(val);
+                }else if(env.params[i] == "probe" && first == BNTPAR){
+                    // At least one probe an hour: the interval must fit in nanoseconds.
+                    env.probeRate  = stod(env.params[i + 1]);
+                    if(!(env.probeRate >= 1.0 / PROBEMAXGAPS) || !isfinite(env.probeRate))
+                        throw out_of_range("probe");
+                }else if(env.params[i] == "scenario" && first == BNTPAR){
+                    env.scenario   = make_shared<const Scenario>(env.params[i + 1], env.iface, env.maxPktSize);
+                }else{
+                    printPromptErr(string("Invalid Command: ") + env.params[i]);
+                    return false;
+                }
+            }catch(const WhException& ex){
+                printPromptErr(ex.what());
+                return false;
+            }catch(...){
+                printPromptErr(string("Invalid Command: ") + env.params[i] + " " + env.params[i + 1]);
+                return false;
+            }
+        }
+        if(env.scenario){
+            // The schedule owns the rate: the pacer starts at the first phase.
+            if(env.rate > 0){
+                printPromptErr("Invalid Command: rate and scenario are exclusive");
+                return false;
+            }
+            env.rate       = env.scenario->initial();
+            env.rateUnit   = env.scenario->getUnit();
+        }
+        return true; 
+    }
    
-    void Wh::trace(const char* header, const uint8_t* buff, const size_t size,
-                   size_t begin, size_t end) const noexcept(true){
-       cerr << header << endl << endl;
-   
-       bool last  = false, first = false;
-       for (size_t i = 0; i < size; i += 16) {
-          cerr << setfill('0') << setw(5) << dec << i << ":  ";
-          for (size_t j = i; j < i + 16; j++) {
-             if(end !=0){
-                if(j == begin ){cerr <<  "\033[7m"; first = true;}
-                if(j == end   ){cerr <<  "\033[0m"; last  = true;}
-             }
-             if(j < size)
-                cerr << setfill('0') << setw(2) << hex
-                          << static_cast<int>(buff[j]) << " ";
-             else cerr << "   ";
-          }
-          if(first){cerr <<  "\033[0m"; }
-          cerr << " ";
-          for (size_t j = i; j < i + 16; j++) {
-             if(end !=0){
-                if((last || j == begin)){cerr <<  "\033[7m"; last  = false; }
-                if(j == end            ){cerr <<  "\033[0m"; last  = false; }
-             }
-             if(j < size){
-                if((buff[j] > 31) && (buff[j] < 128) && (buff[j] != 127))
-                   cerr << buff[j] ;
-                else cerr << "." ;
-             }
-          }
-          first = false;
-          cerr << endl;
-       }
-       cerr << endl << endl;
+    void Wh::trace(const char* header, const uint8_t* buff, const size_t size,
+                   size_t begin, size_t end) const noexcept(true){
+       if(log) 
+           log->dump(header, buff, size, begin, end);
     }
  
     void Wh::trace(string& header, const vector<uint8_t>* buff,
                size_t begin, size_t end, size_t max) const noexcept(true){
-       screenMtx.lock();
-       cerr << header << endl << endl;
-    
-       size_t len    = max ? max : buff->size();
-       bool   last   = false, first = false;
-       for (size_t i = 0; i < len; i += 16) {
-          cerr << setfill('0') << setw(5) << dec << i << ":  ";
-          for (size_t j = i; j < i + 16; j++) {
-             if(end !=0){
-                if(j == begin ){cerr <<  "\033[7m"; first = true;}
-                if(j == end   ){cerr <<  "\033[0m"; last  = true;}
-             }
-             if(j < len)
-                cerr << setfill('0') << setw(2) << hex
-                     << static_cast<int>(buff->at(j)) << " ";
-             else cerr << "   ";
-          }
-          if(first){cerr <<  "\033[0m"; }
-          cerr << " ";
-          for (size_t j = i; j < i + 16; j++) {
-             if(end !=0){
-                if(last && !first   ){cerr << "\033[7m"; last  = false; }
-                if(j == begin       ){cerr << "\033[7m"; first = false; }
-                if(j == end         ){cerr << "\033[0m"; last  = false; }
-             }
-             if(j < len){
-                if((buff->at(j) > 31) && (buff->at(j) < 128) && (buff->at(j) != 127))
-                   cerr << buff->at(j);
-                else cerr << ".";
-             }
-          }
-          first = false;
-          cerr << endl;
-       }
-       cerr << endl << endl;
-       screenMtx.unlock();
+       if(log) 
+           log->dump(header.c_str(), buff->data(), max ? max : buff->size(), begin, end);
     }
     
            
     void Wh::printHelp(void) const noexcept(true){
           screenMtx.lock();
           cerr << "\nCommands:\n--------\n - Create thread:\n"
-               << "     job <target_ip> <type> <code> <pause>\n"
-               << " - Scan mode:\n     scan <target_ip> <pause>\n"
+               << "     job <target_ip> <type> <code> <pause> [rate <n>[k|m|g]pps|bit] [burst <pkts>]\n"
+               << "         [workers <n>] [probe <pps>] [scenario <file>]\n"
+               << "   (a scenario file replaces rate: one phase per line, offsets from the job start,\n"
+               << "    <start> <duration> hold <rate> | ramp <from> <to> | step <from> <to> <steps> |\n"
+               << "    sawtooth <from> <to> <period>, times in s|ms|us, rates as above or line for\n"
+               << "    the link speed, the job ends after the last phase)\n"
+               << " - Fuzz thread, every packet gets 1-4 header or payload mutations:\n"
+               << "     fuzz <target_ip> <type> <code> <pause> [job options] [seed <n>] [from <packet>]\n"
+               << "         [mutate flip|bound|random|mixed] [fields <f>[,<f>...]]\n"
+               << "    (fields: ip icmp payload all vhl tos len id off ttl proto sum type code icsum rest,\n"
+               << "    the same seed and from replay the same packets)\n"
+               << " - Scan mode:\n     scan <target_ip> <pause> [rate <n>[k|m|g]pps|bit] [burst <pkts>]\n"
+               << "         [workers <n>]\n"
+               << "   (a rate replaces the per packet pause, workers split the rate and maxpcksnt,\n"
+               << "    scan workers split the type/code pairs,\n"
+               << "    probe adds an echo stream measuring rtt and loss)\n"
+               << " - Replay a capture:\n     replay <pcap> <target_ip> [rate <n>[k|m|g]pps|bit | timing original]\n"
+               << "         [loops <n>]   (0 loops forever)\n"
                << " - Reset IP header to the default values:\n     reset\n" 
-               << " - List thread:\n     list\n - Kill thread:\n "
+               << " - List thread:\n     list\n"
+               << " - Job counters, once or every <interval> seconds:\n     stats [id|all|off] [interval]\n"
+               << " - Kill thread:\n "
                << "    kill <id>\n - Exit and terminate all the "
                << " threads:\n     exit\n - Set environment:\n     set <var> <value>\n"
                << "     set payload <option> <on/off>\n"
+               << "     set payload random <per-packet/off>\n"
                << " - Wait all the threads complete the tasks and exit:\n"
                << "    wexit\n" 
                << "- List all env variables:\n     set all\n"
@@ -453,7 +3848,7 @@ namespace wh{
                      env.ip->ip_sum == 0 ? cerr << "\t\t0x0" : 
                      cerr << "\t\t" << hex << showbase << env.ip->ip_sum;
            cerr << "\nscanmode\t" << "valids\t\t" << scanModesDescr.at(env.scanmode) 
-                << "\t\tall/alltype/allcode/valids"
+                << "\t\tall/alltype/allcode/valids/adaptive"
                 << "\nsrcaddr\t\t" << "iface addr.\t" 
                 << inet_ntop(AF_INET, &(env.ip->ip_src.s_addr), str, INET_ADDRSTRLEN) 
                 << "\nprint   \t"  << "print incoming\n\t\tdata" << "\t\t" 
@@ -462,6 +3857,30 @@ namespace wh{
                 << (env.debug ? "on" : "off") << "\t\tprint debug info - on/off" 
                 << "\nmaxscanpks\t" << MAXSCANPACKETS << "\t\t" << env.maxPktSent  
                 << "\nmaxpcksnt\t" << MAXSNDPKTSIZE << "\t\t" << env.maxPktSize  
+                << "\nbatch\t\t"  << "1\t\t" << env.batch << "\t\tpackets per sendmmsg - 1/" << MAXBATCH
+                << "\nbackend\t\t" << "raw\t\t" << backendsDescr.at(env.backend) << "\t\traw/packet_mmap/afxdp"
+                << "\nqdiscbypass\t" << "off\t\t" << (env.qdiscBypass ? "on" : "off") 
+                << "\t\tpacket_mmap only - on/off"
+                << "\ndstmac\t\t" << "auto\t\t" << (env.dstMac.empty() ? "auto" : env.dstMac) 
+                << "\tpacket_mmap/afxdp only - auto/mac addr."
+                << "\nxdpqueue\t" << "0\t\t" << env.xdpQueue << "\t\tafxdp only - iface tx queue"
+                << "\ntxtime\t\t" << "off\t\t" << (env.txTime ? "on" : "off") 
+                << "\t\tkernel pacing, raw with job rate - on/off"
+                << "\ntxhorizon\t" << TXHORIZONMS << "\t\t" << env.txHorizon << "\t\ttxtime lead - ms"
+                << "\naffinity\t" << "off\t\t";
+           if(env.affinity == AFFLIST)
+               for(size_t i = 0; i < env.cpuList.size(); ++i)
+                   cerr << (i > 0 ? "," : "") << env.cpuList[i];
+           else
+               cerr << (env.affinity == AFFAUTO ? "auto" : env.affinity == AFFNUMA ? "numa-local" : "off");
+           cerr << "\t\toff/auto/numa-local/cpu list"
+                << "\nscanout\t\t" << "off\t\t" << (env.scanOut.empty() ? "off" : env.scanOut) 
+                << "\tscan results - off/file[.json]"
+                << "\nstatsshm\t" << "off\t\t" << (shm ? shm->getPath() : "off") << "\ton/off/file path"
+                << "\npcap\t\t" << "off\t\t" << (env.pcap ? env.pcap->getPath() : "off") 
+                << "\tfile|off [sent|recv|both] [snaplen]"
+                << "\nlogfile\t\t" << "off\t\t" << (log && !log->getFile().empty() ? log->getFile() : "off") 
+                << "\tpacket dumps - off/file path"
                 << "\nthrdtimeo\t" << "0\t\t" << env.thTimeo << "\t\tsender timeo - seconds" 
                 << "\npayload invlen\t" << "on\t\t" 
                 << (env.payload[INVCHKSPLD]   ? "on" : "off") << "\t\tsend invalid pl checksum - on/off" 
@@ -471,6 +3890,8 @@ namespace wh{
                 << (env.payload[STDPLD]      ? "on" : "off") << "\t\tsend standard pl size, if exists - on/off" 
                 << "\npayload huge\t" << "on\t\t" 
                 << (env.payload[MAXPLD]      ? "on" : "off") << "\t\tsend max pl length - ton/off"
+                << "\npayload random\t" << "off\t\t" 
+                << (env.rndPayload ? "per-packet" : "off") << "\tnew random pl every packet - per-packet/off"
                 << "\n\n";
            screenMtx.unlock();
     }
@@ -512,26 +3933,6 @@ namespace wh{
          close(fd);
     }
     
-    uint16_t Wh::checksum(void *buff, size_t len) const noexcept(true){	
-        uint16_t        odd_byte   =  0,
-                        *buffer    =  static_cast<uint16_t*>(buff);
-        uint32_t        sum        =  0;
-    
-        while(len > 1){
-            sum += *buffer++;
-            len -= 2;
-        }
-
-        if( len == 1 ){
-            *(reinterpret_cast<uint8_t*>(&odd_byte)) = *(reinterpret_cast<uint8_t*>(buffer));
-            sum += odd_byte;
-        }
-    
-        sum =  ( sum >> 16 ) + ( sum & 0xffff ); 
-        sum += ( sum >> 16 );                   
-        return static_cast<uint16_t>(~sum);
-    }
-    
     inline bool Wh::sendpk(const int fd, const uint8_t* buff, const size_t bufflen, 
                            const sockaddr* sin, useconds_t pause) const noexcept(true){
         const char  header[]  = "Packet Sent Dump: ";
@@ -546,6 +3947,454 @@ namespace wh{
         return true;
     }
 
+    size_t Wh::sendBatch(const int fd, vector<struct mmsghdr>& msgs, size_t first, 
+                         size_t cnt, useconds_t pause, JobStat& stat) const noexcept(true){
+        const char  header[]  = "Packet Sent Dump: ";
+        size_t      sent      = 0;
+
+        if(pause > 0) this_thread::sleep_for(chrono::microseconds(static_cast<uint64_t>(pause) * cnt));
+        if(env.debug)
+            for(size_t i = first; i < first + cnt; ++i)
+                trace(header, static_cast<const uint8_t*>(msgs[i].msg_hdr.msg_iov->iov_base),
+                      msgs[i].msg_hdr.msg_iov->iov_len, 0, 0);
+
+        #ifdef LINUX_OS
+            int ret   = sendmmsg(fd, &msgs[first], static_cast<unsigned int>(cnt), 0);
+            if(ret == -1){
+                stat.failed(errno);
+                if(env.debug) printPromptErr(string("Socket Send Error (sendmmsg): ") + strerror(errno));
+            }else
+                sent  = static_cast<size_t>(ret);
+        #else
+            for(size_t i = first; i < first + cnt; ++i, ++sent)
+                if(sendmsg(fd, &msgs[i].msg_hdr, 0) == -1){
+                    stat.failed(errno);
+                    if(env.debug) printPromptErr(string("Socket Send Error (sendmsg): ") + strerror(errno));
+                    break;
+                }
+        #endif
+
+        stat.calls++;
+        stat.slots   += cnt;
+        stat.sent    += sent;
+
+        // A failing message is consumed as sendpk does with a failing sendto. 
+        return sent > 0 ? sent : 1;
+    }
+
+    void Wh::setupBatch(vector<Frame>& frames, Sockaddr_in* sin, vector<struct mmsghdr>& msgs, 
+                        vector<struct iovec>& iovs) const noexcept(false){
+        // Entries repeat the variants cyclically, so a batch can start at any
+        // offset and still continue the sequence left by the previous one.
+        iovs.resize(msgs.size());
+        for(size_t i = 0; i < msgs.size(); ++i){
+            Frame&  fr                  = frames[i % frames.size()];
+            iovs[i].iov_base            = fr.data();
+            iovs[i].iov_len             = fr.size();
+            memset(&msgs[i], 0, sizeof(struct mmsghdr));
+            msgs[i].msg_hdr.msg_name    = sin;
+            msgs[i].msg_hdr.msg_namelen = sizeof(Sockaddr_in);
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+        }
+    }
+
+    void Wh::openTx(Env& cenv, TxPath& tx) const noexcept(false){
+        if(cenv.pcap)
+            tx.pcap = cenv.pcap->attach(PCAPSENT);
+        if(cenv.txTime){
+            #ifdef HAVE_TXTIME
+                if(cenv.backend != RAWSOCK)
+                    throw WhException("openTx: txtime pacing is only available with the raw backend.");
+                if(cenv.rate <= 0)
+                    throw WhException("openTx: txtime pacing requires a job rate.");
+                tx.sched.reset(new LaunchSched(cenv.rate, cenv.rateUnit, cenv.txHorizon * 1000000LL));
+            #else
+                throw WhException("openTx: txtime pacing is not available on this system.");
+            #endif
+        }
+
+        if(cenv.rndPayload && cenv.backend != RAWSOCK)
+            throw WhException("openTx: per-packet random payload is only available with the raw backend.");
+        if(cenv.fuzz && cenv.backend != RAWSOCK)
+            throw WhException("openTx: fuzz jobs are only available with the raw backend.");
+        if(cenv.scenario && cenv.txTime)
+            throw WhException("openTx: scenario jobs are paced in software, disable txtime.");
+
+        tx.sockFd          = openRSocket(cenv);
+        tx.sendFd          = tx.sockFd;
+
+        if(cenv.rate > 0 && !cenv.txTime){
+            // The burst is counted in packets, never smaller than one batch.
+            double  pkts   = max<double>(cenv.burst, cenv.batch);
+            tx.pacer.reset(new TokenBucket(cenv.rate, 
+                                           cenv.rateUnit == BPS ? pkts * cenv.maxPktSize * 8.0 : pkts));
+        }
+
+        switch(cenv.backend){
+            case PKTMMAP:
+                #ifdef LINUX_OS
+                    tx.ring.reset(new TxRing(cenv.iface, cenv.qdiscBypass, cenv.maxPktSize + ETHER_HDR_LEN));
+                    tx.sendFd     = tx.ring->getFd();
+                    tx.srcHwAddr  = tx.ring->getHwAddr();
+                    resolveHwAddr(cenv, tx);
+                #else
+                    throw WhException("openTx: packet_mmap backend is only available on Linux.");
+                #endif
+            break;
+            case AFXDP:
+                #ifdef HAVE_AFXDP
+                    tx.xsk.reset(new XskSocket(cenv.iface, cenv.xdpQueue, cenv.maxPktSize + ETHER_HDR_LEN));
+                    tx.sendFd     = tx.xsk->getFd();
+                    tx.srcHwAddr  = tx.xsk->getHwAddr();
+                    resolveHwAddr(cenv, tx);
+                #else
+                    throw WhException("openTx: afxdp backend is not available on this system.");
+                #endif
+            break;
+            default:
+            break;
+        }
+    }
+
+    void Wh::prepareTx(Env& cenv, uint8_t type, uint8_t code, TxPath& tx) const noexcept(false){
+        if(!tx.cache){
+            // A fuzz run is replayed from its seed alone, template payload included.
+            if(cenv.fuzz)
+                FastRng(cenv.fuzzSeed).fill(cenv.packet.data() + sizeof(Ip) + ICMP_MINLEN, 
+                                            cenv.packet.size() - sizeof(Ip) - ICMP_MINLEN);
+            tx.cache.reset(new FrameCache(cenv));
+        }
+        tx.cache->materialise(type, code, stdSizes[type], tx.frames, tx.kinds);
+        tx.msgs.resize(cenv.batch + tx.frames.size() - 1);
+        setupBatch(tx.frames, &tx.sin, tx.msgs, tx.iovs);
+        tx.next            = 0;
+
+        if(cenv.fuzz){
+            // Each message owns a copy of its frame, mutated in place and 
+            // restored before the next mutation: no frame is rebuilt.
+            if(!tx.fuzz)
+                tx.fuzz.reset(new Fuzzer(cenv.fuzzSeed, cenv.fuzzMode, cenv.fuzzFields));
+            tx.slots.resize(tx.msgs.size());
+            tx.edits.resize(tx.msgs.size());
+            for(size_t i = 0; i < tx.msgs.size(); ++i){
+                tx.slots[i]                 = tx.frames[i % tx.frames.size()];
+                tx.iovs[i].iov_base         = tx.slots[i].data();
+                tx.edits[i].clear();
+                tx.edits[i].reserve(FUZZMAXEDITS);
+            }
+            tx.seq         = cenv.fuzzFrom;
+            tx.next        = cenv.fuzzFrom % tx.frames.size();
+        }else if(cenv.rndPayload){
+            tx.pool        = &PayloadPool::get();
+            tx.heads.resize(tx.msgs.size());
+            tx.iovs.resize(2 * tx.msgs.size());
+            for(size_t i = 0; i < tx.msgs.size(); ++i)
+                tx.msgs[i].msg_hdr.msg_iov  = &tx.iovs[2 * i];
+            tx.randomise(0, tx.msgs.size());
+        }
+
+        #ifdef HAVE_TXTIME
+            if(tx.sched) 
+                tx.sched->attach(tx.msgs);
+        #endif
+
+        #ifdef LINUX_OS
+            if(tx.ring){
+                buildLinkFrames(cenv, tx);
+                tx.ring->load(tx.linkFrames);
+            }
+        #endif
+        #ifdef HAVE_AFXDP
+            if(tx.xsk){
+                buildLinkFrames(cenv, tx);
+                tx.xsk->load(tx.linkFrames);
+            }
+        #endif
+    }
+
+    size_t Wh::transmit(Env& cenv, TxPath& tx, size_t cnt, useconds_t pause, JobStat& stat) const noexcept(true){
+        size_t  done       = 0,
+                first      = tx.next;
+        bool    mapped     = false;
+
+        #ifdef LINUX_OS
+            mapped         = tx.ring != nullptr;
+            #ifdef HAVE_AFXDP
+                mapped    |= tx.xsk  != nullptr;
+            #endif
+        #endif
+
+        // Random payloads and fuzzing need the batch path, one message per packet.
+        bool    gather     = cenv.batch > 1 || cenv.txTime || tx.pool || tx.fuzz;
+
+        if(tx.pacer){
+            // The single packet raw path always sends the whole variant set.
+            if(!mapped && !gather) cnt = tx.frames.size();
+            tx.pacer->acquire(cenv.rateUnit == BPS ? tx.bytes(tx.next, cnt) * 8.0 : static_cast<double>(cnt));
+            pause          = 0;
+        }
+
+        #ifdef LINUX_OS
+            if(mapped){
+                const char  header[]  = "Packet Sent Dump: ";
+                if(pause > 0) this_thread::sleep_for(chrono::microseconds(static_cast<uint64_t>(pause) * cnt));
+                if(env.debug) 
+                    for(size_t i = 0; i < cnt; ++i){
+                        const Frame& fr = tx.frames[(tx.next + i) % tx.frames.size()];
+                        trace(header, fr.data(), fr.size(), 0, 0);
+                    }
+
+                #ifdef HAVE_AFXDP
+                    done     = tx.xsk ? tx.xsk->send(tx.next, cnt) : tx.ring->send(tx.next, cnt);
+                #else
+                    done     = tx.ring->send(tx.next, cnt);
+                #endif
+                stat.calls++;
+                stat.slots  += cnt;
+                stat.sent   += done;
+                tx.account(first, done, stat);
+                tx.next      = (tx.next + done) % tx.frames.size();
+                return done;
+            }
+        #endif
+
+        #ifdef HAVE_TXTIME
+            if(tx.sched){
+                tx.sched->stamp(tx.msgs, tx.next, cnt);
+                pause        = 0;
+            }
+        #endif
+
+        if(gather){
+            if(tx.pool)
+                tx.randomise(tx.next, cnt);
+            if(tx.fuzz)
+                tx.mutate(tx.next, cnt);
+            uint64_t  before = stat.sent.load();
+            done             = sendBatch(tx.sockFd, tx.msgs, tx.next, cnt, pause, stat);
+            size_t    ok     = static_cast<size_t>(stat.sent.load() - before);
+            tx.account(first, ok, stat);
+            if(ok == 0 && tx.matrix)
+                tx.matrix->failed(tx.lane, tx.kinds[first % tx.kinds.size()]);
+            tx.next          = (tx.next + done) % tx.frames.size();
+            tx.seq          += done;
+            #ifdef HAVE_TXTIME
+                if(tx.sched){
+                    tx.sched->drainErrors(tx.sockFd);
+                    stat.missed  = tx.sched->getMissed();
+                }
+            #endif
+        }else{
+            for(size_t i = 0; i < tx.frames.size(); ++i){
+                const Frame&  fr  = tx.frames[i];
+                if(sendpk(tx.sockFd, fr.data(), fr.size(), reinterpret_cast<sockaddr*>(&tx.sin), pause)){
+                    stat.sent++;
+                    tx.account(i, 1, stat);
+                }else{
+                    stat.failed(errno);
+                    if(tx.matrix) tx.matrix->failed(tx.lane, tx.kinds[i]);
+                }
+                done++;
+            }
+        }
+        return done;
+    }
+
+    uint32_t Wh::ringLoop(Env& cenv, TxPath& tx, const JobCtl& ctl, uint32_t maxCount, useconds_t pause, 
+                          JobStat& stat, Probe* probe) noexcept(false){
+        uint32_t        count   = 0;
+        struct pollfd   pfd;
+        pfd.fd          = tx.sendFd;    pfd.events     = POLLOUT;
+
+        // No select() round trip: refill the tx ring as long as it has room,
+        // sleep on the socket only when the completions lag behind.
+        while(ctl.running() && count <= maxCount && follow(cenv, tx, ctl, stat)){
+            size_t  done   = transmit(cenv, tx, min<size_t>(cenv.batch, maxCount + 1 - count), pause, stat);
+            count         += static_cast<uint32_t>(done);
+            if(probe != nullptr)
+                probe->poll(tx.sockFd, *cenv.ip, tx.sin);
+            if(done == 0)
+                poll(&pfd, 1, 1);
+        }
+        return count;
+    }
+
+    bool Wh::follow(Env& cenv, TxPath& tx, const JobCtl& ctl, JobStat& stat) const noexcept(true){
+        if(!tx.pacer)
+            return true;
+
+        // The workers share one budget: the ones still sending take over
+        // the share of a worker that has finished.
+        int      live   = max(ctl.live.load(), 1);
+        if(!cenv.scenario){
+            if(live != tx.shares){
+                double  share  = cenv.rate * cenv.workers / live;
+                tx.shares      = live;
+                tx.pacer->setRate(share);
+                stat.target    = share;
+            }
+            return true;
+        }
+
+        // Re-aim the pacer before every batch, sleep through the gaps
+        // between phases and stop after the last one.
+        for(;;){
+            int64_t  wait   = 0,
+                     curr   = chrono::steady_clock::now().time_since_epoch().count();
+            double   rate   = cenv.scenario->rateAt(curr - tx.origin, tx.phase, wait);
+            if(rate < 0 || !ctl.running())
+                return false;
+            if(rate > 0){
+                tx.pacer->setRate(rate / live);
+                stat.target  = rate / live;
+                return true;
+            }
+            stat.target      = 0;
+            this_thread::sleep_for(chrono::nanoseconds(min<int64_t>(wait, RXPOLLMS * 1000000LL)));
+        }
+    }
+
+    void Wh::attachRx(unsigned long id, Env& cenv, int type, JobStatPtr stat) noexcept(false){
+        // One receiver serves every job, send loops never read.
+        lock_guard<mutex>  lock(rxMtx);
+        if(!rx){
+            rx.reset(new RxWorker([this](unsigned long job, const vector<uint8_t>& buff, size_t len){
+                                      string  header  = string("Reply for thread ") + to_string(job) + ": ";
+                                      trace(header, &buff, 0, 0, len);
+                                  }));
+            if(cenv.pcap)
+                rx->capture(cenv.pcap->attach(PCAPRECV));
+        }
+        rx->subscribe(id, cenv.ip->ip_dst.s_addr, type, cenv.printIncoming, stat);
+    }
+
+    void Wh::detachRx(unsigned long id) noexcept(true){
+        lock_guard<mutex>  lock(rxMtx);
+        if(rx) 
+            rx->unsubscribe(id);
+    }
+
+    #ifdef LINUX_OS
+
+    void Wh::placeThread(Env& cenv, JobStat& stat) const noexcept(false){
+        if(cenv.affinity == AFFNONE)
+            return;
+
+        int          node  = cenv.affinity == AFFLIST ? -1 : Placement::ifaceNode(cenv.iface);
+        vector<int>  cpus  = cenv.affinity == AFFLIST ? cenv.cpuList : 
+                             node >= 0                ? Placement::nodeCpus(node) : Placement::onlineCpus();
+
+        // Workers and successive jobs take the next core of the set, 
+        // numa-local leaves the scheduler free within the node.
+        if(cenv.affinity != AFFNUMA)
+            cpus           = { cpus[cpuSlot++ % cpus.size()] };
+        Placement::pin(cpus);
+
+        // Pinned before openTx and prepareTx: rings, frames and batch 
+        // vectors are first touched on the sender's node.
+        Placement::preferNode(node);
+        stat.cpu           = cpus.size() == 1 ? cpus.front() : -1;
+        stat.node          = node;
+    }
+
+    void Wh::resolveHwAddr(Env& cenv, TxPath& tx) const noexcept(false){
+        unsigned int  mac[ETHER_ADDR_LEN];
+        auto          parseMac  = [&](const string& str) -> bool {
+                                      if(sscanf(str.c_str(), "%x:%x:%x:%x:%x:%x", &mac[0], &mac[1], 
+                                                &mac[2], &mac[3], &mac[4], &mac[5]) != ETHER_ADDR_LEN)
+                                          return false;
+                                      for(size_t i = 0; i < ETHER_ADDR_LEN; ++i)
+                                          tx.dstHwAddr[i] = static_cast<uint8_t>(mac[i]);
+                                      return true;
+                                  };
+
+        if(!cenv.dstMac.empty()){
+            if(!parseMac(cenv.dstMac))
+                throw WhException("resolveHwAddr: invalid dstmac value.");
+            return;
+        }
+
+        // Next hop: the target itself or the gateway of the longest matching route on iface.
+        in_addr_t     target    = tx.sin.sin_addr.s_addr,
+                      hop       = target;
+        int           bestLen   = -1;
+        ifstream      routes("/proc/net/route");
+        string        line;
+        getline(routes, line);
+        while(getline(routes, line)){
+            istringstream  fields(line);
+            string         ifc;
+            unsigned long  dst, gw, flags, refCnt, use, metric, mask;
+            if(!(fields >> ifc >> hex >> dst >> gw >> flags >> dec >> refCnt >> use >> metric >> hex >> mask) || 
+               ifc != cenv.iface || (target & mask) != dst)
+                continue;
+            int  len   = __builtin_popcountl(mask);
+            if(len > bestLen){
+                bestLen  = len;
+                hop      = (flags & RTF_GATEWAY) ? static_cast<in_addr_t>(gw) : target;
+            }
+        }
+
+        in_addr       hopAddr;
+        hopAddr.s_addr          = hop;
+        string        hopStr    = inet_ntoa(hopAddr);
+        auto          lookupArp = [&]() -> bool {
+                                      ifstream  arp("/proc/net/arp");
+                                      string    entry;
+                                      getline(arp, entry);
+                                      while(getline(arp, entry)){
+                                          istringstream  fields(entry);
+                                          string         ipStr, hwType, flags, hwStr, mask, dev;
+                                          if(fields >> ipStr >> hwType >> flags >> hwStr >> mask >> dev &&
+                                             ipStr == hopStr && dev == cenv.iface && flags != "0x0")
+                                              return parseMac(hwStr);
+                                      }
+                                      return false;
+                                  };
+        if(lookupArp()) return;
+
+        // Prime the neighbour cache with a harmless datagram to the discard port.
+        int           udpFd     = socket(AF_INET, SOCK_DGRAM, 0);
+        if(udpFd != -1){
+            Sockaddr_in  dsc    = tx.sin;
+            char         dummy  = 0;
+            dsc.sin_port        = htons(9);
+            sendto(udpFd, &dummy, sizeof(dummy), 0, reinterpret_cast<sockaddr*>(&dsc), sizeof(dsc));
+            close(udpFd);
+        }
+        for(int retry = 0; retry < 10; ++retry){
+            this_thread::sleep_for(chrono::milliseconds(100));
+            if(lookupArp()) return;
+        }
+
+        tx.dstHwAddr.fill(0xFF);
+        printPromptErr(string("Next hop ") + hopStr + " not resolved: using the broadcast hw address.");
+    }
+
+    void Wh::buildLinkFrames(Env& cenv, TxPath& tx) const noexcept(false){
+        tx.linkFrames.clear();
+        for(const auto& fr : tx.frames){
+            Frame                 lfr(ETHER_HDR_LEN + fr.size());
+            struct ether_header   *eth  = reinterpret_cast<struct ether_header*>(lfr.data());
+            memcpy(eth->ether_dhost, tx.dstHwAddr.data(), ETHER_ADDR_LEN);
+            memcpy(eth->ether_shost, tx.srcHwAddr.data(), ETHER_ADDR_LEN);
+            eth->ether_type       = htons(ETHERTYPE_IP);
+            memcpy(lfr.data() + ETHER_HDR_LEN, fr.data(), fr.size());
+
+            // The raw socket has these completed by the kernel, a link frame doesn't.
+            Ip                    *lip  = reinterpret_cast<Ip*>(lfr.data() + ETHER_HDR_LEN);
+            lip->ip_len           = htons(static_cast<uint16_t>(fr.size()));
+            if(cenv.ip->ip_sum == DEFCHKSUM){
+                lip->ip_sum       = 0;
+                lip->ip_sum       = Checksum::compute(lip, min<size_t>(lip->ip_hl * 4U, fr.size()));
+            }
+            tx.linkFrames.push_back(move(lfr));
+        }
+    }
+
+    #endif
+
     int  Wh::openRSocket(Env& cenv) const noexcept(false){
 
         errno              = 0;
@@ -592,17 +4441,65 @@ namespace wh{
                throw WhException("openRSocket: Socket Conf. Error (IP_HDRINCL)");
         }  
 
+        #ifdef LINUX_OS
+            // Replies are read by the receive worker: a send socket would 
+            // only queue a copy of every ICMP packet of the host.
+            try{
+                RxFilter::Program  prog  = RxFilter::dropAll();
+                RxFilter::attach(sockFd, prog);
+            }catch(const WhException& ex){
+                close(sockFd);
+                printPromptErr(ex.what());
+                throw;
+            }
+        #endif
+
+        #ifdef HAVE_TXTIME
+            if(cenv.txTime){
+                try{
+                    LaunchSched::enable(sockFd);
+                }catch(const WhException& ex){
+                    close(sockFd);
+                    printPromptErr(ex.what());
+                    throw;
+                }
+            }
+        #endif
+
         return  sockFd;
     }
 
-    string Wh::getStatus(JOBTYPE type, Env& cenv) const noexcept(false){
+    string Wh::getStatus(JOBTYPE type, Env& cenv, const TxPath* tx) const noexcept(false){
          try{
+              string  backend = backendsDescr.at(cenv.backend);
+              #ifdef LINUX_OS
+                  if(tx != nullptr && tx->ring)
+                      backend += tx->ring->bypassActive() ? "/qdiscbypass" : "/qdisc";
+              #endif
+              #ifdef HAVE_AFXDP
+                  if(tx != nullptr && tx->xsk)
+                      backend += string(tx->xsk->zeroCopy() ? "/zerocopy" : "/copy") + 
+                                 " queue: " + to_string(tx->xsk->getQueue());
+              #endif
+              static_cast<void>(tx);
+
               return string(" --> iface: ")     + cenv.iface    + " srcaddr: " + inet_ntoa(cenv.ip->ip_src) +
                      " dstaddr: "               + cenv.params[1]+ 
                      (type == SCAN ? " icmptype: scan" :
                                      " icmptype: " + to_string(cenv.icmp->icmp_type)   + 
                                      " icmpcode: " + to_string(cenv.icmp->icmp_code) ) +
                      " maxpcks: " + to_string(cenv.maxPktSent) + " thrdtmeo: " + to_string(cenv.thTimeo)    +
+                     " batch: "   + to_string(cenv.batch)      + " backend: "  + backend                    +
+                     (cenv.rate > 0 ? " rate: " + TokenBucket::rateStr(cenv.rate * cenv.workers, cenv.rateUnit) + 
+                                      " burst: " + to_string(max<uint32_t>(cenv.burst, cenv.batch)) : "") +
+                     (cenv.workers > 1 ? " workers: " + to_string(cenv.workers) : "") +
+                     (cenv.probeRate > 0 ? " probe: " + TokenBucket::rateStr(cenv.probeRate, PPS) : "") +
+                     (cenv.txTime ? " pacing: txtime/" + to_string(cenv.txHorizon) + "ms" : "") +
+                     (cenv.fuzz ? " fuzz: " + fuzzModesDescr.at(cenv.fuzzMode) + " seed: " + 
+                                  to_string(cenv.fuzzSeed) + " from: " + to_string(cenv.fuzzFrom) : "") +
+                     (cenv.scenario ? " scenario: " + cenv.scenario->getPath() + " phases: " + 
+                                      to_string(cenv.scenario->getPhases()) + " length: " + 
+                                      to_string(cenv.scenario->getLength() / 1000000) + "ms" : "") +
                      " hdrlen: "  + to_string(cenv.ip->ip_hl)  + " ipver: "    + to_string(cenv.ip->ip_v)   + 
                      " tos: "     + to_string(cenv.ip->ip_tos) + " frgoff: "   + to_string(cenv.ip->ip_off) + 
                      " ttl: "     + to_string(cenv.ip->ip_ttl) + " transp: "   + to_string(cenv.ip->ip_p)   + 
@@ -615,140 +4512,210 @@ namespace wh{
 
     void Wh::addScanThread(void) noexcept(false){
        try{ 
+           int64_t              issued   = chrono::steady_clock::now().time_since_epoch().count();
            countMtx.lock();
            unsigned long        id       = nextThread;
-           get<RUN>(threadsList[id])     = true;
            countMtx.unlock();
+           JobStatPtr           jstat    = make_shared<JobStat>();
            
            confMtx.lock(); 
+           uint16_t             nworkers = env.workers;
+           for(uint16_t w = 0; nworkers > 1 && w < nworkers; ++w)
+               jstat->workers.push_back(make_shared<JobStat>());
+           jstat->target        = env.rate;
+           jstat->targetUnit    = env.rateUnit;
+
+           // The whole type/code space in scan order: each worker takes a contiguous shard.
+           auto                 pairs    = make_shared<vector<pair<uint8_t, uint8_t>>>();
+           bool                 full     = env.scanmode == ALL || env.scanmode == ADAPTIVE;
+           for(const auto& i : (full || env.scanmode == ALLTYPE) ? icmpTypeFull : icmpType){
+                unsigned int  codeMin,
+                              codeMax;
+                if(full || env.scanmode == ALLCODE){
+                    codeMin = 0;
+                    codeMax = 255;
+                }else{ 
+                    codeMin = get<CODEMIN>(i.second) != 255 ? get<CODEMIN>(i.second) : 0;
+                    codeMax = get<CODEMIN>(i.second) != 255 ? get<CODEMAX>(i.second) : 0;
+                }
+                for(unsigned int c = codeMin; c <= codeMax; ++c)
+                    pairs->push_back(make_pair(i.first, static_cast<uint8_t>(c)));
+           }
+           jstat->pairsTotal    = pairs->size();
+           if(env.scanmode == ADAPTIVE)
+               jstat->probe     = make_shared<Probe>(id, ADAPTPROBEPPS);
+
+           // Adaptive scans need the matrix to decide, with or without a file.
+           if(!env.scanOut.empty() || env.scanmode == ADAPTIVE){
+               try{
+                   jstat->matrix    = make_shared<ScanMatrix>(env.scanOut, nworkers);
+               }catch(const WhException& ex){
+                   confMtx.unlock(); 
+                   printPromptErr(ex.what());
+                   return;
+               }
+           }
+
+           JobCtl               *jctl    = nullptr;
+           uint16_t             started  = 0;
            try{
-               get<THREAD>(threadsList[id])  = 
-                   new thread([&](unsigned long idcpy, Env cenv){ 
+               jctl                        = jobs.acquire(id, jstat, "", nworkers);
+               auto  worker  = [&](unsigned long idcpy, Env& cenv, JobStatPtr job, JobCtl* ctl, uint16_t widx,
+                                   shared_ptr<vector<pair<uint8_t, uint8_t>>> shard, int64_t queued){ 
+                      JobStatPtr         stat    = job->workers.empty() ? job : job->workers[widx];
+                      stat->launchNs     = chrono::steady_clock::now().time_since_epoch().count() - queued;
                       if(cenv.params[1].empty() || cenv.params[2].empty()){
                           printPromptErr("Wrong Parameters (dest, pause)."); 
                           goto SYNTERR;
                       }
-                      printPromptErr("New scan thread:\nDestination: \n" + env.params[1] + "\nType: scan\n");
+                      if(widx == 0)
+                          printPromptErr("New scan thread:\nDestination: \n" + cenv.params[1] + "\nType: scan\n" +
+                                         (cenv.workers > 1 ? "Workers: " + to_string(cenv.workers) + "\n" : ""));
 
                       try{
-                           vector<uint8_t>    response(MAXRCVPKTSIZE);
-                           Sockaddr_in        sin,
-                                              sout;
-                           fd_set             readfd, 
-                                              writefd;
-                           socklen_t          inLen;
-                           string             header   = "addScanThread: ";
+                           #ifdef LINUX_OS
+                               placeThread(cenv, *stat);
+                           #endif
+                           fd_set             writefd;
+                           TxPath             tx;
            
-                           cenv.setThreadEnv(&sin, false);
-                           get<DESCR>(threadsList[idcpy]) = getStatus(SCAN, cenv);
+                           cenv.setThreadEnv(&tx.sin, false);
            
                            int                tmpCnv   = stoi(cenv.params[2]);
                            useconds_t         pause    = tmpCnv >= 0 ? static_cast<unsigned int>(tmpCnv) : 0U;  
-                           int sockFd                  = openRSocket(cenv);
-           
-                           for(const auto& i : (cenv.scanmode == ALL || cenv.scanmode == ALLTYPE) ? 
-                                                icmpTypeFull : icmpType){
-                                cenv.icmp->icmp_type  = i.first;
-                                
-                                uint8_t  codeMin,
-                                         codeMax;
+                           openTx(cenv, tx);
+                           if(widx == 0)
+                               ctl->setDescr(getStatus(SCAN, cenv, &tx));
+                           tx.matrix        = job->matrix;
+                           tx.lane          = widx;
+                           attachRx(idcpy, cenv, RXANYTYPE, job);
+                           if(cenv.backend == AFXDP) stat->queue = static_cast<int>(cenv.xdpQueue);
+                           stat->target     = cenv.rate;
+                           stat->targetUnit = cenv.rateUnit;
+                           stat->start      = chrono::steady_clock::now().time_since_epoch().count();
+                           #ifdef HAVE_TXTIME
+                               if(tx.sched) stat->horizon = tx.sched->getHorizon();
+                           #endif
+                           int                maxFd    = tx.sendFd;
+                           size_t             first    = shard->size() * widx / cenv.workers,
+                                              last     = shard->size() * (widx + 1U) / cenv.workers;
+                           uint32_t           maxPckSent = cenv.maxPktSent > 0 ? cenv.maxPktSent : 
+                                                           static_cast<uint32_t>(MAXSCANPACKETS); 
+                           bool               adaptive = cenv.scanmode == ADAPTIVE;
+                           Probe              *probe   = widx == 0 ? job->probe.get() : nullptr;
+
+                           auto  sendPair  = [&](size_t p, uint32_t limit){
+                                uint8_t   type         = (*shard)[p].first,
+                                          code         = (*shard)[p].second;
+                                cenv.icmp->icmp_type   = type;
+                                cenv.icmp->icmp_code   = code;
+                                prepareTx(cenv, type, code, tx);
+                                if(tx.matrix)
+                                    tx.matrix->begin(widx, type, code, tx.frames, tx.kinds);
+
+                                uint32_t  count        = 0;
+                                if(cenv.backend == AFXDP)
+                                    ringLoop(cenv, tx, *ctl, limit, pause, *stat, probe);
+                                else while(ctl->running() && count <= limit && follow(cenv, tx, *ctl, *stat)){ 
            
-                                if(cenv.scanmode == ALL || cenv.scanmode == ALLCODE){
-                                    codeMin = 0;
-                                    codeMax = 255;
-                                }else{ 
-                                    codeMin = get<CODEMIN>(i.second) != 255 ? get<CODEMIN>(i.second) : 0;
-                                    codeMax = get<CODEMIN>(i.second) != 255 ? get<CODEMAX>(i.second) : 0;
+                                     FD_ZERO(&writefd);
+                                     FD_SET(tx.sendFd, &writefd);
+
+                                     errno             = 0; 
+                                     if(select(maxFd+1, nullptr, &writefd, nullptr, nullptr) > 0 && errno == 0){
+                                         if(FD_ISSET(tx.sendFd, &writefd))
+                                             count    += static_cast<uint32_t>(transmit(cenv, tx, 
+                                                             min<size_t>(cenv.batch, limit + 1 - count),
+                                                             pause, *stat));
+                                         if(probe != nullptr)
+                                             probe->poll(tx.sockFd, *cenv.ip, tx.sin);
+                                         if(job->probe)
+                                             tx.matrix->sample(widx, job->probe->lastRtt());
+                                     }
                                 }
+                           };
            
-                                for(uint8_t c = codeMin; c <= codeMax; c++){
-                                    cenv.icmp->icmp_code   = c;
-                                    bool      stdPld       = icmpType.find(cenv.icmp->icmp_type) != icmpType.end() 
-                                                             ? true : false;
-                                    uint16_t  stdSize      = sizeof(Ip) + 
-                                                                 (icmpType.find(cenv.icmp->icmp_type) != 
-                                                                  icmpType.end() ?
-                                                                  get<CODEPSIZE>(icmpType.at(cenv.icmp->icmp_type)) : 
-                                                                 ICMP_MINLEN);
-
-                                    uint16_t  stdChks      = checksum(cenv.icmp, stdSize - sizeof(Ip)),
-                                              zeroSize     = sizeof(Ip) + ICMP_MINLEN,
-                                              minChks      = checksum(cenv.icmp, ICMP_MINLEN), 
-                                              maxSize      = env.maxPktSize,
-                                              maxChks      = checksum(cenv.icmp, env.maxPktSize - sizeof(Ip));
-                                    uint32_t  count        = 0;
-                   
-                                    uint32_t maxPckSent    = MAXSCANPACKETS; 
-                                    while(get<RUN>(threadsList[idcpy]) && 
-                                                   count <= (cenv.maxPktSent > 0 ? 
-                                                             cenv.maxPktSent : maxPckSent)){ 
-           
-                                         FD_ZERO(&readfd);          FD_ZERO(&writefd);
-                                         FD_SET(sockFd,  &readfd);  FD_SET(sockFd,  &writefd);
-
-                                         errno             = 0; 
-                                         if(select(sockFd+1, &readfd, &writefd, nullptr, nullptr) > 0 && errno == 0){
-                                             if(FD_ISSET(sockFd, &writefd)){
-                                                 if(cenv.payload[NOPLD]){
-                                                     cenv.ip->ip_len          = zeroSize;
-                                                     cenv.icmp->icmp_cksum    = minChks;
-                                                     sendpk(sockFd, cenv.packet.data(), zeroSize,
-                                                               reinterpret_cast<sockaddr*>(&sin), pause);
-                                                     count++;
-                                                 }
-
-                                                 if(cenv.payload[INVCHKSPLD]){
-                                                     cenv.ip->ip_len          = zeroSize;
-                                                     cenv.icmp->icmp_cksum    = stdChks;
-                                                     sendpk(sockFd, cenv.packet.data(), zeroSize,
-                                                               reinterpret_cast<sockaddr*>(&sin), pause);
-                                                     count++;
-                                                 }
-           
-                                                 if(cenv.payload[STDPLD] && stdPld){
-                                                     cenv.ip->ip_len          = stdSize;
-                                                     cenv.icmp->icmp_cksum    = stdChks;
-                                                     sendpk(sockFd, cenv.packet.data(), stdSize,
-                                                               reinterpret_cast<sockaddr*>(&sin), pause);
-                                                     count++;
-                                                 }
-           
-                                                 if(cenv.payload[MAXPLD]){
-                                                     cenv.ip->ip_len          = maxSize;
-                                                     cenv.icmp->icmp_cksum    = maxChks;
-                                                     sendpk(sockFd, cenv.packet.data(), maxSize,
-                                                               reinterpret_cast<sockaddr*>(&sin), pause);
-                                                     count++;
-                                                 }
-                                             }
-                                             if(FD_ISSET(sockFd, &readfd)){
-                                                 ssize_t res = recvfrom(sockFd, response.data(), MAXRCVPKTSIZE, 0, 
-                                                          reinterpret_cast<sockaddr*>(&sout), &inLen); 
-                                                 if(cenv.printIncoming){
-                                                    if(res > 0) trace(header, &response, 0, 0, 
-                                                                      static_cast<size_t>(res));
-                                                    else        printPromptErr("addScanThread: Reading error.");
-                                                 }
-                                             }
-                                         }
-                                    }
+                           // Adaptive: a short burst for every pair first, the rest of the
+                           // budget only for the pairs the target reacted to.
+                           for(size_t p = first; p < last && ctl->running(); ++p){
+                                if(adaptive)
+                                    tx.matrix->hold(static_cast<uint16_t>((*shard)[p].first << 8 | (*shard)[p].second));
+                                sendPair(p, adaptive ? min<uint32_t>(ADAPTBURST, maxPckSent) : maxPckSent);
+                                if(ctl->running() && !adaptive)
+                                    job->pairsDone++;
+                           }
+                           if(adaptive && ctl->running()){
+                                this_thread::sleep_for(chrono::milliseconds(SCANGRACEMS));
+                                int64_t          base  = tx.matrix->baseline();
+                                vector<size_t>   hot;
+                                for(size_t p = first; p < last; ++p){
+                                     uint16_t  key  = static_cast<uint16_t>((*shard)[p].first << 8 | (*shard)[p].second);
+                                     if(maxPckSent > ADAPTBURST && tx.matrix->reacted(key, base)){
+                                         hot.push_back(p);
+                                     }else{
+                                         tx.matrix->settle(key);
+                                         job->pairsDone++;
+                                     }
                                 }
-                            }
-                            close(sockFd);
-                            printPromptErr(string("Thread ") + to_string(idcpy) + " exits.", true);
+                                job->pairsHot  += hot.size();
+                                for(size_t i = 0; i < hot.size() && ctl->running(); ++i){
+                                     sendPair(hot[i], maxPckSent - ADAPTBURST);
+                                     tx.matrix->settle(static_cast<uint16_t>((*shard)[hot[i]].first << 8 | 
+                                                                             (*shard)[hot[i]].second));
+                                     if(ctl->running())
+                                         job->pairsDone++;
+                                }
+                           }
+                           printPromptErr(string("Thread ") + to_string(idcpy) + 
+                                          (cenv.workers > 1 ? " worker " + to_string(widx) : "") + " exits.", true);
+                     }catch(const WhException& ex){
+                          printPromptErr(string("Thread of type scan exits for error: ") + ex.what(), true);
                      }catch(...){
-                          printPromptErr("Thread of type job exits for unhandled error.", true);
+                          printPromptErr("Thread of type scan exits for unhandled error.", true);
                      }
                      SYNTERR:
-                     threadsList.erase(idcpy); 
-             },id, env);
-                 get<THREAD>(threadsList[id])->detach();
+                     if(!job->workers.empty())
+                         stat->target  = 0;
+                     if(--ctl->live == 0){
+                         if(job->matrix){
+                             job->matrix->finish();
+                             if(job->probe)
+                                 printPromptErr(string("Scan ") + to_string(idcpy) + " " + to_string(job->pairsHot.load()) +
+                                                " of " + to_string(job->pairsTotal.load()) + " pairs reacted, " + 
+                                                job->probe->summary(true), true);
+                             if(!job->matrix->getPath().empty())
+                                 printPromptErr("Scan results written to " + job->matrix->getPath(), true);
+                         }
+                         detachRx(idcpy);
+                         jobs.release(ctl); 
+                     }
+               };
+               for(; started < nworkers; ++started){
+                   uint16_t w        = started;
+                   // Shards share the rate budget, maxscanpks stays per pair.
+                   Env      wenv(env);
+                   wenv.rate         = env.rate  / nworkers;
+                   wenv.burst        = env.burst / nworkers;
+                   wenv.xdpQueue     = env.xdpQueue + w;
+                   senders.submit(bind(worker, id, move(wenv), jstat, jctl, w, pairs, issued));
+               }
            
            }catch(...){
                  confMtx.unlock(); 
-                 countMtx.lock();
-                 nextThread--;
-                 countMtx.unlock();
+                 if(jctl != nullptr){
+                     jobs.stop(id);
+                     if(jctl->live.fetch_sub(nworkers - started) == nworkers - started){
+                         detachRx(id);
+                         jobs.release(jctl);
+                     }
+                 }
+                 // Workers already queued run under id until they see the stop: 
+                 // the id stays consumed, only a job that never started gives it back.
+                 if(started > 0){
+                     countMtx.lock();
+                     nextThread++;
+                     countMtx.unlock();
+                 }
                  printPromptErr("Error creating thread.");
                  throw;
            }
@@ -768,33 +4735,12 @@ namespace wh{
        try{
            countMtx.lock();
            unsigned long      id        = nextThread;
-           get<RUN>(threadsList[id])    = true;
-           get<DESCR>(threadsList[id])  = " --> wait-to-exit thread";
            countMtx.unlock();
+           jobs.acquire(id, nullptr, " --> wait-to-exit thread");
         
+           // The shell loop sleeps on the registry until this slot is the last one.
            shutDown                     = SHACT;
         
-           try{
-               get<THREAD>(threadsList[id])  = 
-                   new thread([&](){ 
-                       try{
-                           while(shutDown == SHACT){
-                               if(threadsList.size() == 1)
-                                   shutDown    = SHEXPIRED;
-                           } 
-                       }catch(...){
-                           printPromptErr("Thread of type waitExit exits for unhandled error.", true);
-                       }
-                   });
-                   get<THREAD>(threadsList[id])->detach();
-           }catch(...){
-                 countMtx.lock();
-                 nextThread--;
-                 countMtx.unlock();
-                 printPromptErr("Error creating checker thread.");
-                 throw;
-           }
-        
            countMtx.lock();
            nextThread++;
            countMtx.unlock();
@@ -807,128 +4753,160 @@ namespace wh{
     
     void  Wh::addJobThread(void) noexcept(false){
        try{
+           int64_t              issued    = chrono::steady_clock::now().time_since_epoch().count();
            countMtx.lock();
            unsigned long        id        = nextThread;
-           get<RUN>(threadsList[id])      = true;
            countMtx.unlock();
+           JobStatPtr           jstat     = make_shared<JobStat>();
 
            confMtx.lock(); 
+           // The send loop stops after maxpcksnt + 1 packets: a worker whose 
+           // share of that would be empty is never started.
+           uint64_t             budget    = static_cast<uint64_t>(env.maxPktSent) + 1;
+           uint16_t             nworkers  = env.scenario ? env.workers : 
+                                            static_cast<uint16_t>(min<uint64_t>(env.workers, budget));
+           for(uint16_t w = 0; nworkers > 1 && w < nworkers; ++w)
+               jstat->workers.push_back(make_shared<JobStat>());
+           jstat->target        = env.rate;
+           jstat->targetUnit    = env.rateUnit;
+           if(env.probeRate > 0)
+               jstat->probe     = make_shared<Probe>(id, env.probeRate);
+           JobCtl               *jctl     = nullptr;
+           uint16_t             started   = 0;
            try{
-               get<THREAD>(threadsList[id])  = 
-                   new thread([&](unsigned long idcpy, Env cenv){
+               jctl                         = jobs.acquire(id, jstat, "", nworkers);
+               auto  worker  = [&](unsigned long idcpy, Env& cenv, JobStatPtr job, JobCtl* ctl, uint16_t widx,
+                                   int64_t queued){
+                       JobStatPtr         stat    = job->workers.empty() ? job : job->workers[widx];
+                       stat->launchNs     = chrono::steady_clock::now().time_since_epoch().count() - queued;
+                       Probe              *probe  = widx == 0 ? job->probe.get() : nullptr;
                        if(cenv.params[1].empty() || cenv.params[2].empty() || 
                           cenv.params[3].empty() || cenv.params[4].empty()){
                               printPromptErr("Wrong Parameters (dest,icmp type and code, pause, required)."); 
                               goto SYNTAXERR;
                        }
-                       printPromptErr("New job thread:\nDestination: \n" + cenv.params[1] + "\nType: " +
-                                      cenv.params[2] + "\nCode: " + cenv.params[3]);
+                       if(widx == 0)
+                           printPromptErr("New job thread:\nDestination: \n" + cenv.params[1] + "\nType: " +
+                                          cenv.params[2] + "\nCode: " + cenv.params[3] + 
+                                          (cenv.workers > 1 ? "\nWorkers: " + to_string(cenv.workers) : "") +
+                                          (cenv.fuzz ? "\nFuzz seed: " + to_string(cenv.fuzzSeed) : ""));
 
                        try{
-                           vector<uint8_t>    response(MAXRCVPKTSIZE);
-                           Sockaddr_in        sin,
-                                              sout;
-                           fd_set             readfd,
-                                              writefd;
-                           socklen_t          inLen;
-                           string             header   = "jobIcmp: ";
+                           #ifdef LINUX_OS
+                               placeThread(cenv, *stat);
+                           #endif
+                           fd_set             writefd;
+                           TxPath             tx;
                        
-                           cenv.setThreadEnv(&sin, true);
-                           get<DESCR>(threadsList[idcpy]) = getStatus(STD, cenv);
+                           cenv.setThreadEnv(&tx.sin, true);
             
                            int                tmpCnv  = stoi(cenv.params[4]);
                            useconds_t         pause   = tmpCnv >= 0 ? static_cast<unsigned int>(tmpCnv) : 0U;  
-                           int sockFd                 = openRSocket(cenv);
+                           openTx(cenv, tx);
+                           if(widx == 0)
+                               ctl->setDescr(getStatus(STD, cenv, &tx));
+                           attachRx(idcpy, cenv, cenv.icmp->icmp_type, job);
+                           if(cenv.backend == AFXDP) stat->queue = static_cast<int>(cenv.xdpQueue);
+                           stat->target     = cenv.rate;
+                           stat->targetUnit = cenv.rateUnit;
+                           stat->start      = chrono::steady_clock::now().time_since_epoch().count();
+                           #ifdef HAVE_TXTIME
+                               if(tx.sched) stat->horizon = tx.sched->getHorizon();
+                           #endif
+                           int                maxFd   = tx.sendFd;
             
-                           if( cenv.thTimeo > 0){
-                               thread* timeoTh = new thread([&](unsigned long idxTimeo){ 
-                                                     try{
-                                                         unsigned long target = idxTimeo;
-                                                         this_thread::sleep_for(chrono::seconds(idxTimeo));
-                                                         get<RUN>(threadsList[target]) = false;
-                                                     }catch(...){
-                                                         printPromptErr("Thread of type timer exits for "
-                                                                        "unhandled error.", true);
-                                                     }
-                                                     return 0; 
-                                                 }, (cenv.thTimeo));
-                               timeoTh->detach();
-                           }
+                           // The timeout covers the whole job: the last worker out cancels it.
+                           if(cenv.thTimeo > 0 && widx == 0)
+                               ctl->deadline = timers.schedule(static_cast<int64_t>(cenv.thTimeo) * 1000000000LL,
+                                                               [this, idcpy](){ jobs.stop(idcpy); });
             
-                           bool      stdPld        = icmpType.find(cenv.icmp->icmp_type) != icmpType.end() 
-                                                     ? true : false;
-                           uint16_t  stdSize       = sizeof(Ip) + 
-                                                    (icmpType.find(cenv.icmp->icmp_type) != icmpType.end() ?
-                                                     get<CODEPSIZE>(icmpType.at(cenv.icmp->icmp_type)) : 
-                                                     ICMP_MINLEN);
-
-                           uint16_t  stdChks       = checksum(cenv.icmp, stdSize - sizeof(Ip)),
-                                     zeroSize      = sizeof(Ip) + ICMP_MINLEN,
-                                     minChks       = checksum(cenv.icmp, ICMP_MINLEN), 
-                                     maxSize       = env.maxPktSize,
-                                     maxChks       = checksum(cenv.icmp, env.maxPktSize - sizeof(Ip));
-                           uint32_t  count         = 0;
-
-                           while(get<RUN>(threadsList[idcpy]) && 
-                                          count <= (cenv.maxPktSent > 0 ? 
-                                                   cenv.maxPktSent : 0)){ 
+                           prepareTx(cenv, cenv.icmp->icmp_type, cenv.icmp->icmp_code, tx);
+
+                           // A scenario ends with its last phase, not with maxpcksnt.
+                           uint32_t  count         = 0,
+                                     maxCount      = cenv.scenario ? numeric_limits<uint32_t>::max() - MAXBATCH :
+                                                     cenv.maxPktSent > 0 ? cenv.maxPktSent : 0;
+                           tx.origin               = queued;
+
+                           if(cenv.backend == AFXDP)
+                               count               = ringLoop(cenv, tx, *ctl, maxCount, pause, *stat, probe);
+                           else while(ctl->running() && count <= maxCount && follow(cenv, tx, *ctl, *stat)){ 
             
-                                FD_ZERO(&readfd);          FD_ZERO(&writefd);
-                                FD_SET(sockFd,  &readfd);  FD_SET(sockFd,  &writefd);
+                                FD_ZERO(&writefd);
+                                FD_SET(tx.sendFd, &writefd);
                                    
-                                if(select(sockFd+1, &readfd, &writefd, nullptr, nullptr) > 0){
-                                    if(FD_ISSET(sockFd, &writefd)){
-                                        if(cenv.payload[NOPLD]){        
-                                            cenv.ip->ip_len          = zeroSize;
-                                            cenv.icmp->icmp_cksum    = minChks;
-                                            sendpk(sockFd, cenv.packet.data(), zeroSize,
-                                                      reinterpret_cast<sockaddr*>(&sin), pause);
-                                            count++;
-                                        }
-            
-                                        if(cenv.payload[STDPLD] && stdPld){  
-                                            cenv.ip->ip_len          = stdSize;
-                                            cenv.icmp->icmp_cksum    = stdChks;
-                                            sendpk(sockFd, cenv.packet.data(), stdSize,
-                                                      reinterpret_cast<sockaddr*>(&sin), pause);
-                                            count++;
-                                        }
-            
-                                        if(cenv.payload[MAXPLD] ){     
-                                            cenv.ip->ip_len          = maxSize;
-                                            cenv.icmp->icmp_cksum    = maxChks;
-                                            sendpk(sockFd, cenv.packet.data(), maxSize,
-                                                      reinterpret_cast<sockaddr*>(&sin), pause);
-                                            count++;
-                                        }
-                                    }
-                                    if(FD_ISSET(sockFd, &readfd)){
-                                        ssize_t res = recvfrom(sockFd, response.data(), MAXRCVPKTSIZE, 0, 
-                                                 reinterpret_cast<sockaddr*>(&sout), &inLen);
-                                        if(cenv.printIncoming){
-                                            if(res > 0) trace(header, &response, 0, 0, static_cast<size_t>(res));
-                                            else        printPromptErr("addScanThread: Reading error.");
-                                        }
-                                    }
+                                if(select(maxFd+1, nullptr, &writefd, nullptr, nullptr) > 0){
+                                    if(FD_ISSET(tx.sendFd, &writefd))
+                                        count    += static_cast<uint32_t>(transmit(cenv, tx, 
+                                                        min<size_t>(cenv.batch, maxCount + 1 - count), 
+                                                        pause, *stat));
+                                    if(probe != nullptr)
+                                        probe->poll(tx.sockFd, *cenv.ip, tx.sin);
                                 }
                     }
+                    if(tx.fuzz)
+                        printPromptErr(string("Thread ") + to_string(idcpy) + 
+                                       (cenv.workers > 1 ? " worker " + to_string(widx) : "") + 
+                                       " fuzz seed: " + to_string(cenv.fuzzSeed) + " next packet: " + 
+                                       to_string(tx.seq), true); 
             
-                    close(sockFd);
                     printPromptErr(string("Thread ") + to_string(idcpy) + " exits.", true); 
+               }catch(const WhException& ex){
+                   printPromptErr(string("Thread of type job exits for error: ") + ex.what(), true);
                }catch(...){
                    printPromptErr("Thread of type job exits for unhandled error.", true);
                }
 
                SYNTAXERR:
-               threadsList.erase(idcpy);
-           },id, env);
-               get<THREAD>(threadsList[id])->detach();
+               if(!job->workers.empty())
+                   stat->target  = 0;
+               if(--ctl->live == 0){
+                   uint64_t  deadline  = ctl->deadline.exchange(0);
+                   if(deadline != 0)
+                       timers.cancel(deadline);
+                   if(job->probe){
+                       // Late replies still count: the last probes get a grace period.
+                       this_thread::sleep_for(chrono::milliseconds(PROBEGRACEMS));
+                       printPromptErr(string("Job ") + to_string(idcpy) + " " + job->probe->summary(true), true);
+                   }
+                   detachRx(idcpy);
+                   jobs.release(ctl);
+               }
+           };
+               for(; started < nworkers; ++started){
+                   uint16_t w        = started;
+                   // Every worker has its own socket and frames and a slice of the budget.
+                   Env      wenv(env);
+                   wenv.rate         = env.rate  / nworkers;
+                   wenv.burst        = env.burst / nworkers;
+                   wenv.xdpQueue     = env.xdpQueue + w;
+                   wenv.fuzzSeed     = env.fuzzSeed + w;
+                   wenv.workers      = nworkers;
+                   wenv.maxPktSent   = static_cast<uint32_t>(budget / nworkers + 
+                                                             (w < budget % nworkers ? 1 : 0) - 1);
+                   senders.submit(bind(worker, id, move(wenv), jstat, jctl, w, issued));
+               }
          
            }catch(...){
                  confMtx.unlock(); 
-                 countMtx.lock();
-                 nextThread--;
-                 countMtx.unlock();
+                 if(jctl != nullptr){
+                     // Account for the workers that never started.
+                     jobs.stop(id);
+                     if(jctl->live.fetch_sub(nworkers - started) == nworkers - started){
+                         uint64_t  deadline  = jctl->deadline.exchange(0);
+                         if(deadline != 0)
+                             timers.cancel(deadline);
+                         detachRx(id);
+                         jobs.release(jctl);
+                     }
+                 }
+                 // Workers already queued run under id until they see the stop: 
+                 // the id stays consumed, only a job that never started gives it back.
+                 if(started > 0){
+                     countMtx.lock();
+                     nextThread++;
+                     countMtx.unlock();
+                 }
                  printPromptErr("Error creating thread.");
                  throw;
            }
@@ -944,19 +4922,213 @@ namespace wh{
        }
     }
    
+    void  Wh::addReplayThread(void) noexcept(false){
+       try{
+           double      rate    = 0;
+           RATEUNIT    unit    = PPS;
+           bool        orig    = false;
+           unsigned long loops = 1;
+           in_addr     dst;
+           for(size_t i = REPLAYPAR; i + 1 < currParam + 1U; i += 2){
+               try{
+                   if(env.params[i] == "rate")
+                       rate    = TokenBucket::parseRate(env.params[i + 1], unit);
+                   else if(env.params[i] == "timing" && env.params[i + 1] == "original")
+                       orig    = true;
+                   else if(env.params[i] == "loops")
+                       loops   = stoul(env.params[i + 1]);
+                   else
+                       throw invalid_argument("option");
+               }catch(...){
+                   printPromptErr(string("Invalid Command: ") + env.params[i] + " " + env.params[i + 1]);
+                   return;
+               }
+           }
+           if(inet_pton(AF_INET, env.params[2].c_str(), &dst) != 1){
+               printPromptErr("Wrong Parameters (pcap file, dest)."); 
+               return;
+           }
+           shared_ptr<PcapFile>  cap;
+           try{
+               cap             = make_shared<PcapFile>(env.params[1]);
+           }catch(const WhException& ex){
+               printPromptErr(ex.what());
+               return;
+           }
+
+           int64_t              issued   = chrono::steady_clock::now().time_since_epoch().count();
+           countMtx.lock();
+           unsigned long        id       = nextThread;
+           countMtx.unlock();
+           JobStatPtr           jstat    = make_shared<JobStat>();
+           jstat->target        = orig ? 0 : rate;
+           jstat->targetUnit    = unit;
+           JobCtl               *jctl    = jobs.acquire(id, jstat, "");
+
+           confMtx.lock(); 
+           try{
+               senders.submit(bind([&](unsigned long idcpy, Env& cenv, JobStatPtr stat, JobCtl* ctl, shared_ptr<PcapFile> file,
+                          in_addr_t daddr, double prate, RATEUNIT punit, bool timing, unsigned long nloops, int64_t queued){
+                      stat->launchNs     = chrono::steady_clock::now().time_since_epoch().count() - queued;
+                      printPromptErr("New replay thread:\nCapture: \n" + cenv.params[1] + "\nDestination: \n" + 
+                                     cenv.params[2] + "\n");
+                      int  fd  = -1;
+                      try{
+                           #ifdef LINUX_OS
+                               placeThread(cenv, *stat);
+                           #endif
+                           fd                     = openRSocket(cenv);
+                           Sockaddr_in  sin;
+                           memset(&sin, 0, sizeof(sin));
+                           sin.sin_family         = AF_INET;
+                           sin.sin_addr.s_addr    = daddr;
+                           cenv.ip->ip_dst.s_addr = daddr;
+                           ctl->setDescr(" --> replay: " + cenv.params[1] + " (" + to_string(file->getSize()) + 
+                                         " bytes) dstaddr: " + cenv.params[2] + 
+                                         (timing ? " timing: original" : prate > 0 ? " rate: " + 
+                                                   TokenBucket::rateStr(prate, punit) : "") + 
+                                         " loops: " + (nloops > 0 ? to_string(nloops) : "forever"));
+                           attachRx(idcpy, cenv, RXANYTYPE, stat);
+                           stat->start            = chrono::steady_clock::now().time_since_epoch().count();
+
+                           // Only the header and the start of the transport header are copied, 
+                           // to rewrite the destination: the payload goes out from the mapping.
+                           size_t                          batch  = timing ? 1 : cenv.batch > 1 ? cenv.batch : static_cast<size_t>(REPLAYBATCH);
+                           vector<array<uint8_t, REPLAYHDRMAX>>  heads(batch);
+                           vector<struct iovec>            iovs(2 * batch);
+                           vector<struct mmsghdr>          msgs(batch);
+                           vector<size_t>                  lens(batch);
+                           unique_ptr<TokenBucket>         pacer;
+                           if(prate > 0 && !timing)
+                               pacer.reset(new TokenBucket(prate, punit == BPS ? batch * MAXSNDPKTSIZE * 8.0 : batch));
+
+                           size_t                          off    = PCAPHDRLEN;
+                           unsigned long                   loop   = 0;
+                           int64_t                         first  = -1;
+                           auto                            origin = chrono::steady_clock::now();
+                           bool                            more   = true;
+                           while(more && ctl->running()){
+                               size_t          cnt    = 0,
+                                               total  = 0;
+                               const uint8_t   *pkt   = nullptr;
+                               uint32_t        plen   = 0;
+                               int64_t         ns     = 0;
+                               while(cnt < batch){
+                                   if(!file->next(off, pkt, plen, ns)){
+                                       off    = PCAPHDRLEN;
+                                       first  = -1;
+                                       if(++loop == nloops || !file->next(off, pkt, plen, ns)){
+                                           more  = false;
+                                           break;
+                                       }
+                                   }
+                                   if(timing){
+                                       if(first < 0){
+                                           first   = ns;
+                                           origin  = chrono::steady_clock::now();
+                                       }
+                                       // Long gaps are slept in slices: a killed job leaves its pool thread at once.
+                                       auto  due  = origin + chrono::nanoseconds(ns - first);
+                                       while(ctl->running() && chrono::steady_clock::now() < due)
+                                           this_thread::sleep_until(min(due, chrono::steady_clock::now() + 
+                                                                             chrono::milliseconds(RXPOLLMS)));
+                                   }
+
+                                   size_t    hl    = (pkt[0] & 0x0F) * 4U;
+                                   if(hl < sizeof(Ip) || hl > plen)
+                                       continue;
+                                   size_t    copy  = min<size_t>(plen, min<size_t>(hl + 20, REPLAYHDRMAX));
+                                   uint8_t   *h    = heads[cnt].data();
+                                   Ip        *ip   = reinterpret_cast<Ip*>(h);
+                                   memcpy(h, pkt, copy);
+
+                                   in_addr_t  old  = ip->ip_dst.s_addr;
+                                   if(old != daddr){
+                                       ip->ip_sum       = Checksum::update(ip->ip_sum, &old, &daddr, sizeof(daddr));
+                                       // TCP and UDP cover the destination through the pseudo header.
+                                       size_t    ckoff  = ip->ip_p == IPPROTO_TCP ? hl + 16 : 
+                                                          ip->ip_p == IPPROTO_UDP ? hl + 6  : 0;
+                                       uint16_t  l4sum  = 0;
+                                       if(ckoff > 0 && (ntohs(ip->ip_off) & IP_OFFMASK) == 0 && copy >= ckoff + 2){
+                                           memcpy(&l4sum, h + ckoff, sizeof(l4sum));
+                                           if(ip->ip_p == IPPROTO_TCP || l4sum != 0){
+                                               l4sum    = Checksum::update(l4sum, &old, &daddr, sizeof(daddr));
+                                               if(ip->ip_p == IPPROTO_UDP && l4sum == 0) l4sum = 0xFFFF;
+                                               memcpy(h + ckoff, &l4sum, sizeof(l4sum));
+                                           }
+                                       }
+                                       ip->ip_dst.s_addr = daddr;
+                                   }
+                                   #ifndef LINUX_OS
+                                       ip->ip_len       = ntohs(ip->ip_len);
+                                       ip->ip_off       = ntohs(ip->ip_off);
+                                   #endif
+
+                                   iovs[2 * cnt].iov_base          = h;
+                                   iovs[2 * cnt].iov_len           = copy;
+                                   iovs[2 * cnt + 1].iov_base      = const_cast<uint8_t*>(pkt + copy);
+                                   iovs[2 * cnt + 1].iov_len       = plen - copy;
+                                   memset(&msgs[cnt], 0, sizeof(struct mmsghdr));
+                                   msgs[cnt].msg_hdr.msg_name      = &sin;
+                                   msgs[cnt].msg_hdr.msg_namelen   = sizeof(sin);
+                                   msgs[cnt].msg_hdr.msg_iov       = &iovs[2 * cnt];
+                                   msgs[cnt].msg_hdr.msg_iovlen    = plen > copy ? 2 : 1;
+                                   lens[cnt]                       = plen;
+                                   total                          += plen;
+                                   cnt++;
+                               }
+                               if(cnt == 0)
+                                   continue;
+
+                               if(pacer)
+                                   pacer->acquire(punit == BPS ? total * 8.0 : static_cast<double>(cnt));
+                               for(size_t f = 0; f < cnt && ctl->running(); ){
+                                   uint64_t  before = stat->sent.load();
+                                   size_t    done   = sendBatch(fd, msgs, f, cnt - f, 0, *stat);
+                                   for(size_t i = f; i < f + static_cast<size_t>(stat->sent.load() - before); ++i)
+                                       stat->bytes.fetch_add(lens[i], memory_order_relaxed);
+                                   f       += done;
+                               }
+                           }
+                           printPromptErr(string("Thread ") + to_string(idcpy) + " exits.", true);
+                      }catch(const WhException& ex){
+                           printPromptErr(string("Thread of type replay exits for error: ") + ex.what(), true);
+                      }catch(...){
+                           printPromptErr("Thread of type replay exits for unhandled error.", true);
+                      }
+                      if(fd != -1) close(fd);
+                      detachRx(idcpy);
+                      jobs.release(ctl); 
+               }, id, env, jstat, jctl, cap, dst.s_addr, rate, unit, orig, loops, issued));
+           }catch(...){
+                 confMtx.unlock(); 
+                 jobs.release(jctl);
+                 printPromptErr("Error creating thread.");
+                 throw;
+           }
+    
+           confMtx.unlock(); 
+           countMtx.lock();
+           nextThread++;
+           countMtx.unlock();
+       }catch(const bad_alloc& ex){
+            throw WhException(string("addReplayThread: ") + ex.what());
+       }catch(...){
+            throw WhException("addReplayThread: Error creating the thread.");
+       }
+    }
+    
     void Wh::killThread(void) noexcept(true){
        confMtx.lock(); 
        try{
            unsigned long id     = stoul(env.params[1]);
-           if(env.params[1].empty() || threadsList.find(id) == threadsList.end()){
+           if(env.params[1].empty() || !jobs.stop(id))
                printPromptErr("Wrong Parameter."); 
-           }else{
-               get<RUN>(threadsList[id]) = false;
-               threadsList.erase(id);
+           else
                printPromptErr(string("Killed thread no: ") + env.params[1]); 
-           }
        confMtx.unlock(); 
        }catch(const invalid_argument& ex){
+               confMtx.unlock(); 
                printPromptErr(string("Wrong Parameter - Invalid argument: ")  +  
                                      ex.what());
        }
@@ -982,6 +5154,82 @@ namespace wh{
         return 0;
     }
     
+    int Wh::setRandomPayload(string& mode) noexcept(true){
+        if(mode == "per-packet")
+            env.rndPayload    = true;
+        else if(mode == "off")
+            env.rndPayload    = false;
+        else
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        return 0;
+    }
+    
+    int Wh::setBatchSize(string& size) noexcept(true){
+        try{
+            int  val    = stoi(size, nullptr, 0);
+            if(val < 1 || val > MAXBATCH)
+                printPromptErr(string("Invalid batch size, expected 1-") + to_string(MAXBATCH));
+            else
+                env.batch = static_cast<uint16_t>(val);
+        }catch(...){
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        }
+        return 0;
+    }
+
+    int Wh::setBackend(string& mode) noexcept(true){
+        try{
+            env.backend = backends.at(mode);
+        }catch(const out_of_range& e){
+            static_cast<void>(e);
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        }
+        return 0;
+    }
+
+    int Wh::setQdiscBypass(string& mode) noexcept(true){
+        try{
+            env.qdiscBypass = opts.at(mode);
+        }catch(const out_of_range& e){
+            static_cast<void>(e);
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        }
+        return 0;
+    }
+
+    int Wh::setTxTime(string& mode) noexcept(true){
+        try{
+            env.txTime = opts.at(mode);
+        }catch(const out_of_range& e){
+            static_cast<void>(e);
+            printPromptErr(string("Invalid Command: ") + env.params[0]);
+        }
+        return 0;
+    }
+
+    int Wh::setAffinity(string& mode) noexcept(true){
+        #ifdef LINUX_OS
+            try{
+                if(mode == "off"){
+                    env.affinity  = AFFNONE;
+                }else if(mode == "auto"){
+                    env.affinity  = AFFAUTO;
+                }else if(mode == "numa-local"){
+                    env.affinity  = AFFNUMA;
+                }else{
+                    env.cpuList   = Placement::parseList(mode);
+                    env.affinity  = AFFLIST;
+                }
+            }catch(...){
+                printPromptErr(string("Invalid cpu list: ") + mode);
+            }
+        #else
+            static_cast<void>(mode);
+            printPromptErr("Thread affinity is only available on Linux.");
+        #endif
+        return 0;
+    }
+
     int Wh::setPrintMode(string& mode) noexcept(true){
         try{
             env.printIncoming = opts.at(mode);
@@ -994,7 +5242,7 @@ namespace wh{
     
     int Wh::setScanMode(string& mode) noexcept(true){
         try{
-            env.printIncoming = opts.at(mode);
+            env.scanmode      = scanModes.at(mode);
         }catch(const out_of_range& e){
             static_cast<void>(e);
             printPromptErr(string("Invalid Command: ") + env.params[0]);
@@ -1029,11 +5277,23 @@ namespace wh{
     
     void Wh::shellLoop(void){
          int            stdIn     = -1;
+         char           buff[SHELLBUFSIZE];
+         ssize_t        avail     = 0,
+                        pos       = 0;
          env.params[0].clear();
     
+         // Batch input is read a block at a time and consumed from the buffer.
          while(!isatty(STDIN_FILENO)){
-             char       curr;
-             ssize_t    status    = read(STDIN_FILENO, &curr, 1);
+             char       curr      = '\0';
+             ssize_t    status    = 1;
+             if(pos == avail){
+                 avail            = read(STDIN_FILENO, buff, sizeof(buff));
+                 pos              = 0;
+                 status           = avail > 0 ? 1 : avail;
+                 if(avail < 0)    avail = 0;
+             }
+             if(status == 1)
+                 curr             = buff[pos++];
     
              switch(status){
   	      case  1:
@@ -1069,8 +5329,9 @@ namespace wh{
          }
       
          stage = WAIT; 
-         while(shutDown == SHACT){
-            sleep(1);
+         if(shutDown == SHACT){
+            jobs.waitIdle(1);
+            shutDown  = SHEXPIRED;
          }
     
          stage = INTERACTIVE;
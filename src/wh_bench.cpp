@@ -0,0 +1,106 @@
+// --------------------------------------------------------------------------
+// wh (Wild Horde) - a tool capable to send heavy malformed icmp packets traffic
+// Copyright (C) 2017  Gabriele Bonacini
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// --------------------------------------------------------------------------
+
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+
+#include <wh.hpp>
+
+using namespace std;
+using namespace wh;
+
+// Payload generation benchmark, run by make bench: the cost of an Env copy,
+// which fills the packet buffer, and of a random payload per packet, each
+// against the generator the tool used before the pooled one.
+
+enum BENCHRUN { BENCHCOPIES=2000, BENCHPACKETS=200000, BENCHMSGS=64 };
+
+static volatile uint32_t sink;
+
+// The generator Env::genRnd used to build on every call.
+static void reference(vector<uint8_t>& array, size_t start){
+    random_device              rdev;
+    mt19937                    gen(rdev());
+    uniform_int_distribution<> dis(0, 255);
+
+    for(auto i = array.begin() + static_cast<ptrdiff_t>(start); i != array.end(); ++i)
+        *i = static_cast<uint8_t>(dis(gen));
+}
+
+template<typename F>
+static double perItem(size_t count, F&& body){
+    auto  start  = chrono::steady_clock::now();
+    for(size_t i = 0; i < count; ++i)
+        body(i);
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / static_cast<double>(count);
+}
+
+static void report(const char* what, double before, double after){
+    cout << left << setw(24) << what << right << fixed << setprecision(1)
+         << setw(12) << before << " ns" << setw(12) << after << " ns"
+         << setw(10) << before / after << "x" << endl;
+}
+
+int main(void){
+    string           iface("lo");
+    Env              base(iface);
+    Ip               hdr{};
+    size_t           start  = sizeof(Ip) + ICMP_MINLEN,
+                     plen   = base.maxPktSize - start;
+
+    base.ip                 = &hdr;
+    cout << "packet " << base.maxPktSize << " bytes, payload " << plen << " bytes" << endl
+         << left << setw(24) << "" << right << setw(15) << "before" << setw(15) << "after" << endl;
+
+    // Startup: every job and scan worker copies the Env.
+    vector<uint8_t>  packet(base.maxPktSize);
+    double  before  = perItem(BENCHCOPIES, [&](size_t){ reference(packet, start); sink += packet[start]; }),
+            after   = perItem(BENCHCOPIES, [&](size_t){ Env copy(base); sink += copy.packet[start]; });
+    report("env copy", before, after);
+
+    // Per packet: a fresh payload and its checksum, against a pool segment
+    // sent behind a private copy of the headers.
+    TxPath           tx;
+    Icmp             *icmp  = reinterpret_cast<Icmp*>(packet.data() + sizeof(Ip));
+    icmp->icmp_type         = ICMP_ECHO;
+    tx.frames.push_back(packet);
+    tx.kinds.push_back(STDPLD);
+    tx.pool                 = &PayloadPool::get();
+    tx.msgs.resize(BENCHMSGS);
+    tx.iovs.resize(2 * BENCHMSGS);
+    tx.heads.resize(BENCHMSGS);
+    for(size_t i = 0; i < BENCHMSGS; ++i){
+        memset(&tx.msgs[i], 0, sizeof(struct mmsghdr));
+        tx.msgs[i].msg_hdr.msg_iov  = &tx.iovs[2 * i];
+    }
+
+    FastRng&         rng    = FastRng::local();
+    before  = perItem(BENCHPACKETS, [&](size_t){
+                                        rng.fill(packet.data() + start, plen);
+                                        icmp->icmp_cksum  = 0;
+                                        icmp->icmp_cksum  = Checksum::compute(icmp, packet.size() - sizeof(Ip));
+                                        sink += icmp->icmp_cksum; });
+    after   = perItem(BENCHPACKETS / BENCHMSGS, [&](size_t){
+                                        tx.randomise(0, BENCHMSGS);
+                                        sink += tx.heads[0][start - 1]; }) / BENCHMSGS;
+    report("random payload", before, after);
+
+    return EXIT_SUCCESS;
+}
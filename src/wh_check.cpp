@@ -0,0 +1,148 @@
+// --------------------------------------------------------------------------
+// wh (Wild Horde) - a tool capable to send heavy malformed icmp packets traffic
+// Copyright (C) 2017  Gabriele Bonacini
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// --------------------------------------------------------------------------
+
+#include <string>
+#include <iostream>
+
+#include <wh.hpp>
+
+using namespace std;
+using namespace wh;
+
+// Self checks, run by make check: the block kernel picked for this cpu and
+// the RFC 1624 updates must agree with the word by word loop on random
+// buffers of every alignment and length, and a txtime bit rate must charge
+// random payload packets for all their bytes.
+
+enum CHECKRUN { CHKROUNDS=4000, CHKSHORT=512, CHKALIGN=16, CHKREPORT=10, CHKSEED=0x5748434b,
+                CHKMSGS=64, CHKBITRATE=1000000000 };
+
+static uint16_t reference(const uint8_t* buff, size_t len){
+    uint32_t   sum   = 0;
+    uint16_t   word  = 0;
+
+    for(; len > 1; buff += 2, len -= 2){
+        memcpy(&word, buff, sizeof(word));
+        sum   += word;
+    }
+    if(len == 1){
+        word   = 0;
+        *(reinterpret_cast<uint8_t*>(&word)) = *buff;
+        sum   += word;
+    }
+
+    sum  =  ( sum >> 16 ) + ( sum & 0xffff );
+    sum += ( sum >> 16 );
+    return static_cast<uint16_t>(~sum);
+}
+
+// 0x0000 and 0xffff are the two one's complement zeros.
+static bool same(uint16_t left, uint16_t right){
+    return left == right || (static_cast<uint16_t>(~left) == 0 && right == 0) ||
+                            (left == 0 && static_cast<uint16_t>(~right) == 0);
+}
+
+#ifdef HAVE_TXTIME
+// One bit per nanosecond: the gap after each message is its size in bits.
+static unsigned long launchGaps(void){
+    const size_t     sizes[]   = { sizeof(Ip) + ICMP_MINLEN, 64, MAXSNDPKTSIZE };
+    TxPath           tx;
+    LaunchSched      sched(CHKBITRATE, BPS, numeric_limits<int64_t>::max());
+    unsigned long    failures  = 0;
+
+    for(size_t len : sizes){
+        tx.frames.push_back(Frame(len));
+        tx.kinds.push_back(STDPLD);
+    }
+    tx.pool                    = &PayloadPool::get();
+    tx.msgs.resize(CHKMSGS);
+    tx.iovs.resize(2 * CHKMSGS);
+    tx.heads.resize(CHKMSGS);
+    for(size_t i = 0; i < CHKMSGS; ++i){
+        memset(&tx.msgs[i], 0, sizeof(struct mmsghdr));
+        tx.msgs[i].msg_hdr.msg_iov  = &tx.iovs[2 * i];
+    }
+    tx.randomise(0, CHKMSGS);
+    sched.attach(tx.msgs);
+    sched.stamp(tx.msgs, 0, CHKMSGS);
+
+    uint64_t         prev      = 0;
+    for(size_t i = 0; i < CHKMSGS; ++i){
+        uint64_t  launch  = 0;
+        memcpy(&launch, CMSG_DATA(CMSG_FIRSTHDR(&tx.msgs[i].msg_hdr)), sizeof(launch));
+        if(i > 0){
+            uint64_t  want  = tx.frames[(i - 1) % tx.frames.size()].size() * 8;
+            if(launch - prev != want && ++failures <= CHKREPORT)
+                cerr << "txtime: message " << i << " launched " << launch - prev 
+                     << "ns after the previous one, expected " << want << "ns" << endl;
+        }
+        prev              = launch;
+    }
+
+    cout << "txtime: " << CHKMSGS << " random payload messages, " << failures << " mismatches" << endl;
+    return failures;
+}
+#endif
+
+int main(void){
+    FastRng          rng(CHKSEED);
+    vector<uint8_t>  buff(MAXRCVPKTSIZE + CHKALIGN),
+                     saved;
+    unsigned long    failures  = 0;
+
+    auto  check  = [&](const char* what, size_t off, size_t len, uint16_t want, uint16_t got){
+                       if(same(want, got))
+                           return;
+                       if(++failures <= CHKREPORT)
+                           cerr << what << ": offset " << off << " length " << len << " expected 0x"
+                                << hex << want << " got 0x" << got << dec << endl;
+                   };
+
+    for(size_t round = 0; round < CHKROUNDS; ++round){
+        size_t    off    = rng.next() % CHKALIGN,
+                  len    = rng.next() % (round % 2 == 0 ? CHKSHORT : MAXRCVPKTSIZE + 1);
+        uint8_t   *data  = buff.data() + off;
+        rng.fill(buff.data(), buff.size());
+
+        uint16_t  sum    = Checksum::compute(data, len);
+        check("compute", off, len, reference(data, len), sum);
+        if(len < 2)
+            continue;
+
+        // One aligned word, as materialise patches type and code.
+        size_t    at     = (rng.next() % (len / 2)) * 2;
+        uint16_t  oldWord,
+                  newWord = static_cast<uint16_t>(rng.next());
+        memcpy(&oldWord, data + at, sizeof(oldWord));
+        memcpy(data + at, &newWord, sizeof(newWord));
+        sum              = Checksum::update(sum, oldWord, newWord);
+        check("update word", off, len, reference(data, len), sum);
+
+        // A run of words, as the fuzzer and replay rewrite headers.
+        size_t    run    = (rng.next() % ((len - at) / 2) + 1) * 2;
+        saved.assign(data + at, data + at + run);
+        rng.fill(data + at, run);
+        sum              = Checksum::update(sum, saved.data(), data + at, run);
+        check("update run", off, len, reference(data, len), sum);
+    }
+
+    cout << "checksum: " << CHKROUNDS << " buffers, " << failures << " mismatches" << endl;
+    #ifdef HAVE_TXTIME
+        failures        += launchGaps();
+    #endif
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}